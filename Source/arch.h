@@ -10,6 +10,8 @@
 #define KING_BUCKETS 16
 #define INPUT_QUANT 255
 #define L1_QUANT 128
+#define L2_QUANT 64
+#define L3_QUANT 1024
 #define INPUT_SHIFT 9
 
 #endif
@@ -27,57 +27,50 @@ uint8_t stm_in_check(position_t *pos);
 void init_sliders_attacks(void);
 void init_leapers_attacks(void);
 
-// get bishop attacks
-static inline uint64_t get_bishop_attacks(int square, uint64_t occupancy) {
-  // get bishop attacks assuming current board occupancy
+// BMI2 builds index the slider tables with PEXT, which gathers the relevant
+// occupancy bits in a single instruction. Zen 1 and 2 run PEXT in microcode,
+// the Makefile keeps magics for them by defining NO_PEXT.
+#if defined(__BMI2__) && !defined(NO_PEXT)
+#define USE_PEXT
+#include <immintrin.h>
+#endif
+
+// index of the bishop attacks of square for the given occupancy
+static inline uint64_t bishop_attack_index(int square, uint64_t occupancy) {
+#ifdef USE_PEXT
+  return _pext_u64(occupancy, bishop_masks[square]);
+#else
   occupancy &= bishop_masks[square];
   occupancy *= bishop_magic_numbers[square];
-  occupancy >>= 64 - bishop_relevant_bits[square];
-
-  // return bishop attacks
-  return bishop_attacks[square][occupancy];
+  return occupancy >> (64 - bishop_relevant_bits[square]);
+#endif
 }
 
-// get rook attacks
-static inline uint64_t get_rook_attacks(int square, uint64_t occupancy) {
-  // get rook attacks assuming current board occupancy
+// index of the rook attacks of square for the given occupancy
+static inline uint64_t rook_attack_index(int square, uint64_t occupancy) {
+#ifdef USE_PEXT
+  return _pext_u64(occupancy, rook_masks[square]);
+#else
   occupancy &= rook_masks[square];
   occupancy *= rook_magic_numbers[square];
-  occupancy >>= 64 - rook_relevant_bits[square];
+  return occupancy >> (64 - rook_relevant_bits[square]);
+#endif
+}
 
-  // return rook attacks
-  return rook_attacks[square][occupancy];
+// get bishop attacks
+static inline uint64_t get_bishop_attacks(int square, uint64_t occupancy) {
+  return bishop_attacks[square][bishop_attack_index(square, occupancy)];
+}
+
+// get rook attacks
+static inline uint64_t get_rook_attacks(int square, uint64_t occupancy) {
+  return rook_attacks[square][rook_attack_index(square, occupancy)];
 }
 
 // get queen attacks
 static inline uint64_t get_queen_attacks(int square, uint64_t occupancy) {
-  // init result attacks bitboard
-  uint64_t queen_attacks = 0ULL;
-
-  // init bishop occupancies
-  uint64_t bishop_occupancy = occupancy;
-
-  // init rook occupancies
-  uint64_t rook_occupancy = occupancy;
-
-  // get bishop attacks assuming current board occupancy
-  bishop_occupancy &= bishop_masks[square];
-  bishop_occupancy *= bishop_magic_numbers[square];
-  bishop_occupancy >>= 64 - bishop_relevant_bits[square];
-
-  // get bishop attacks
-  queen_attacks = bishop_attacks[square][bishop_occupancy];
-
-  // get rook attacks assuming current board occupancy
-  rook_occupancy &= rook_masks[square];
-  rook_occupancy *= rook_magic_numbers[square];
-  rook_occupancy >>= 64 - rook_relevant_bits[square];
-
-  // get rook attacks
-  queen_attacks |= rook_attacks[square][rook_occupancy];
-
-  // return queen attacks
-  return queen_attacks;
+  return get_bishop_attacks(square, occupancy) |
+         get_rook_attacks(square, occupancy);
 }
 
 static inline uint64_t get_pawn_attacks(uint8_t side, int square) {
@@ -0,0 +1,15 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+// Only linked into fat builds, and the only file of them built for baseline
+// x86-64 (see the Makefile). Everything else assumes x86-64-v3, so the cpu is
+// checked here before main, while no such code has run yet, and a cpu without
+// AVX2 gets a message rather than an illegal instruction.
+__attribute__((constructor(101))) static void check_cpu(void) {
+  __builtin_cpu_init();
+  if (!__builtin_cpu_supports("avx2") || !__builtin_cpu_supports("bmi2")) {
+    fputs("This build of Quanticade needs a cpu with AVX2 and BMI2.\n",
+          stderr);
+    exit(1);
+  }
+}
@@ -1,8 +1,14 @@
+#include "enums.h"
 #include "movegen.h"
 #include "nnue.h"
 #include "search.h"
 #include "structs.h"
+#include "threads.h"
+#include "transposition.h"
 #include "uci.h"
+#include "utils.h"
+#include <inttypes.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -43,17 +49,11 @@ static void free_book(fen_book_t *book) {
     book->count = 0;
 }
 
-uint8_t play_rand_moves(position_t *pos, thread_t *thread, uint8_t rand_moves) {
-    moves pseudo_moves[1];
+uint8_t play_rand_moves(position_t *pos, search_t *search, uint8_t rand_moves) {
+    thread_t *thread = search->threads;
     moves legal_moves[1];
-    legal_moves->count = 0;
-    generate_noisy(pos, pseudo_moves, 0);
-    generate_quiets(pos, pseudo_moves, 1);
-    for (uint16_t moves = 0; moves < pseudo_moves->count; ++moves) {
-        if (is_pseudo_legal(pos, pseudo_moves->entry[moves].move) && is_legal(pos, pseudo_moves->entry[moves].move)) {
-            add_move(legal_moves, pseudo_moves->entry[moves].move);
-        }
-    }
+    generate_noisy(pos, legal_moves, 0);
+    generate_quiets(pos, legal_moves, 1);
     if (legal_moves->count == 0) {
         return 0;
     }
@@ -64,10 +64,11 @@ uint8_t play_rand_moves(position_t *pos, thread_t *thread, uint8_t rand_moves) {
         strcpy(input, "position fen ");
         strcat(input, fen);
         parse_position(pos, thread, input);
-        init_accumulator(pos, &thread->accumulator[thread->ply]);
+        init_accumulator(pos, &thread->tables->accumulator[thread->ply]);
         init_finny_tables(thread, pos);
-        time_control(pos, thread, "go depth 10");
-        search_position(pos, thread);
+        increment_tt_age();
+        time_control(search, pos, "go depth 10");
+        search_position(search, pos);
         if (abs(thread->score) > 1000) {
             return 0;
         }
@@ -77,11 +78,12 @@ uint8_t play_rand_moves(position_t *pos, thread_t *thread, uint8_t rand_moves) {
     uint16_t move = legal_moves->entry[rand() % legal_moves->count].move;
     position_t pos_copy = *pos;
     make_move(&pos_copy, move);
-    return play_rand_moves(&pos_copy, thread, rand_moves - 1);
+    return play_rand_moves(&pos_copy, search, rand_moves - 1);
 }
 
-void genfens(position_t *pos, thread_t *thread, uint64_t seed,
+void genfens(position_t *pos, search_t *search, uint64_t seed,
              uint16_t n_of_fens, const char *bookfile) {
+    thread_t *thread = search->threads;
     srand(seed);
 
     fen_book_t book = {NULL, 0};
@@ -98,15 +100,394 @@ void genfens(position_t *pos, thread_t *thread, uint64_t seed,
             char input[512];
             sprintf(input, "position fen %s", fen);
             parse_position(pos, thread, input);
-            init_accumulator(pos, &thread->accumulator[thread->ply]);
+            init_accumulator(pos, &thread->tables->accumulator[thread->ply]);
             init_finny_tables(thread, pos);
         }
         position_t pos_copy = *pos;
         int random_moves = 6 + rand() % 4;
-        if (play_rand_moves(&pos_copy, thread, random_moves))
+        if (play_rand_moves(&pos_copy, search, random_moves))
             generated_fens++;
     }
 
     if (use_book)
         free_book(&book);
 }
+
+#define EVAL_LINE_SIZE 256
+
+// One batch of lines handed to a thread by eval_batch
+typedef struct {
+    thread_t *thread;
+    char (*lines)[EVAL_LINE_SIZE];
+    int count;
+    position_t *positions;
+    uint16_t *line_index;
+    int16_t *scores;
+    int16_t *line_scores;
+    uint8_t *valid;
+} eval_job_t;
+
+static void *eval_lines(void *arg) {
+    eval_job_t *job = (eval_job_t *)arg;
+    char input[EVAL_LINE_SIZE + 16];
+    int positions = 0;
+
+    for (int i = 0; i < job->count; ++i) {
+        position_t *pos = &job->positions[positions];
+        snprintf(input, sizeof(input), "position fen %s", job->lines[i]);
+        parse_position(pos, job->thread, input);
+        job->valid[i] = popcount(pos->bitboards[K]) == 1 &&
+                        popcount(pos->bitboards[k]) == 1;
+        if (job->valid[i]) {
+            job->line_index[positions++] = i;
+        }
+    }
+
+    nnue_evaluate_batch(job->thread, job->positions, positions, job->scores);
+    for (int i = 0; i < positions; ++i) {
+        job->line_scores[job->line_index[i]] = job->scores[i];
+    }
+    return NULL;
+}
+
+// Reads one FEN per line from in_file and writes "<line> | <eval>" to
+// out_file, the eval being from the side to move. Lines are read in chunks
+// of NNUE_BATCH_SIZE per thread and every thread evaluates its share as one
+// batch. Lines without both kings are skipped.
+void eval_batch(const char *in_file, const char *out_file, int thread_count) {
+    FILE *in = fopen(in_file, "r");
+    if (!in) {
+        printf("Could not open %s\n", in_file);
+        return;
+    }
+    FILE *out = fopen(out_file, "w");
+    if (!out) {
+        printf("Could not open %s for writing\n", out_file);
+        fclose(in);
+        return;
+    }
+
+    thread_t *threads = init_threads(thread_count);
+    const int chunk = thread_count * NNUE_BATCH_SIZE;
+    char (*lines)[EVAL_LINE_SIZE] = malloc(chunk * sizeof(*lines));
+    position_t *positions = malloc(chunk * sizeof(position_t));
+    uint16_t *line_index = malloc(chunk * sizeof(uint16_t));
+    int16_t *scores = malloc(chunk * sizeof(int16_t));
+    int16_t *line_scores = malloc(chunk * sizeof(int16_t));
+    uint8_t *valid = malloc(chunk);
+    eval_job_t *jobs = malloc(thread_count * sizeof(eval_job_t));
+    if (!threads || !lines || !positions || !line_index || !scores ||
+        !line_scores || !valid || !jobs) {
+        fprintf(stderr, "Evalbatch memory allocation failed.\n");
+        goto cleanup;
+    }
+
+    for (int i = 0; i < thread_count; ++i) {
+        position_t start;
+        parse_position(&start, &threads[i], "position startpos");
+        init_finny_tables(&threads[i], &start);
+    }
+
+    uint64_t evaluated = 0, skipped = 0;
+    const uint64_t start_time = get_time_ms();
+    char buffer[EVAL_LINE_SIZE];
+    uint8_t done = 0;
+
+    while (!done) {
+        int count = 0;
+        while (count < chunk) {
+            if (!fgets(buffer, sizeof(buffer), in)) {
+                done = 1;
+                break;
+            }
+            // a line longer than the buffer keeps its start, the fen
+            if (!strchr(buffer, '\n')) {
+                int ch;
+                while ((ch = fgetc(in)) != '\n' && ch != EOF)
+                    ;
+            }
+            buffer[strcspn(buffer, "\r\n")] = '\0';
+            if (buffer[0]) {
+                strcpy(lines[count++], buffer);
+            }
+        }
+
+        const int per_thread = (count + thread_count - 1) / thread_count;
+        int started = 0;
+        for (int i = 0; i < thread_count; ++i) {
+            const int first = MIN(i * per_thread, count);
+            jobs[i] = (eval_job_t){
+                .thread = &threads[i],
+                .lines = &lines[first],
+                .count = MIN(per_thread, count - first),
+                .positions = &positions[first],
+                .line_index = &line_index[first],
+                .scores = &scores[first],
+                .line_scores = &line_scores[first],
+                .valid = &valid[first],
+            };
+            if (i > 0 && jobs[i].count > 0) {
+                if (thread_pool_start(i - 1, eval_lines, &jobs[i])) {
+                    started = i;
+                } else {
+                    eval_lines(&jobs[i]);
+                }
+            }
+        }
+        eval_lines(&jobs[0]);
+        thread_pool_wait(started);
+
+        for (int i = 0; i < count; ++i) {
+            if (valid[i]) {
+                fprintf(out, "%s | %d\n", lines[i], line_scores[i]);
+                evaluated++;
+            } else {
+                skipped++;
+            }
+        }
+    }
+
+    const uint64_t elapsed = get_time_ms() - start_time + 1;
+    printf("evaluated %" PRIu64 " positions, skipped %" PRIu64
+           ", %" PRIu64 " positions/s\n",
+           evaluated, skipped, evaluated * 1000 / elapsed);
+
+cleanup:
+    free(jobs);
+    free(valid);
+    free(line_scores);
+    free(scores);
+    free(line_index);
+    free(positions);
+    free(lines);
+    free_threads(threads, thread_count);
+    fclose(out);
+    fclose(in);
+}
+
+// Reads the next non empty line of a FEN file and sets up its position.
+// Returns 0 at the end of the file, lines without both kings are skipped.
+static uint8_t next_fen_position(FILE *in, position_t *pos, thread_t *thread) {
+    char buffer[EVAL_LINE_SIZE];
+    char input[EVAL_LINE_SIZE + 16];
+
+    while (fgets(buffer, sizeof(buffer), in)) {
+        if (!strchr(buffer, '\n')) {
+            int ch;
+            while ((ch = fgetc(in)) != '\n' && ch != EOF)
+                ;
+        }
+        buffer[strcspn(buffer, "\r\n")] = '\0';
+        if (!buffer[0]) {
+            continue;
+        }
+        snprintf(input, sizeof(input), "position fen %s", buffer);
+        parse_position(pos, thread, input);
+        if (popcount(pos->bitboards[K]) == 1 &&
+            popcount(pos->bitboards[k]) == 1) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Reads one FEN per line from in_file and reports how far the integer layers
+// after L1 are from the float ones, in centipawns of the raw eval
+void tail_check(const char *in_file) {
+    FILE *in = fopen(in_file, "r");
+    if (!in) {
+        printf("Could not open %s\n", in_file);
+        return;
+    }
+
+    thread_t *thread = init_threads(1);
+    if (!thread) {
+        fclose(in);
+        return;
+    }
+    position_t pos;
+    parse_position(&pos, thread, "position startpos");
+    init_finny_tables(thread, &pos);
+
+    uint64_t evaluated = 0, sign_flips = 0, over_10 = 0;
+    double abs_sum = 0, sq_sum = 0, bias_sum = 0;
+    int max_diff = 0;
+
+    while (next_fen_position(in, &pos, thread)) {
+        int16_t float_score, int_score;
+        nnue_evaluate_tails(thread, &pos, &float_score, &int_score);
+        const int diff = int_score - float_score;
+        evaluated++;
+        bias_sum += diff;
+        abs_sum += abs(diff);
+        sq_sum += (double)diff * diff;
+        max_diff = MAX(max_diff, abs(diff));
+        over_10 += abs(diff) > 10;
+        sign_flips += (float_score > 0 && int_score < 0) ||
+                      (float_score < 0 && int_score > 0);
+    }
+
+    if (evaluated) {
+        printf("positions %" PRIu64 "\n", evaluated);
+        printf("mean error %.3f\n", bias_sum / evaluated);
+        printf("mean absolute error %.3f\n", abs_sum / evaluated);
+        printf("rms error %.3f\n", sqrt(sq_sum / evaluated));
+        printf("max absolute error %d\n", max_diff);
+        printf("errors above 10 %" PRIu64 " (%.3f%%)\n", over_10,
+               100.0 * over_10 / evaluated);
+        printf("sign flips %" PRIu64 "\n", sign_flips);
+    } else {
+        printf("No positions in %s\n", in_file);
+    }
+
+    free_threads(thread, 1);
+    fclose(in);
+}
+
+// Reads one FEN per line from in_file and writes which L1 neurons are active
+// in each position to out_file, one bit per neuron and L1_SIZE / 8 bytes per
+// position. Tools/process_net reorders the neurons of a network with it.
+void nnz_sample(const char *in_file, const char *out_file) {
+    FILE *in = fopen(in_file, "r");
+    if (!in) {
+        printf("Could not open %s\n", in_file);
+        return;
+    }
+    FILE *out = fopen(out_file, "wb");
+    if (!out) {
+        printf("Could not open %s for writing\n", out_file);
+        fclose(in);
+        return;
+    }
+
+    thread_t *thread = init_threads(1);
+    if (thread) {
+        position_t pos;
+        parse_position(&pos, thread, "position startpos");
+        init_finny_tables(thread, &pos);
+
+        uint64_t sampled = 0, active_blocks = 0;
+        uint8_t activations[L1_SIZE];
+        uint8_t mask[L1_SIZE / 8];
+
+        while (next_fen_position(in, &pos, thread)) {
+            nnue_l1_activations(thread, &pos, activations);
+            memset(mask, 0, sizeof(mask));
+            for (int i = 0; i < L1_SIZE; ++i) {
+                mask[i / 8] |= (activations[i] != 0) << (i % 8);
+            }
+            for (int i = 0; i < L1_SIZE; i += 4) {
+                active_blocks += (activations[i] | activations[i + 1] |
+                                  activations[i + 2] | activations[i + 3]) != 0;
+            }
+            fwrite(mask, sizeof(mask), 1, out);
+            sampled++;
+        }
+
+        printf("sampled %" PRIu64 " positions, %.2f of %d L1 blocks nonzero\n",
+               sampled, sampled ? (double)active_blocks / sampled : 0.0,
+               L1_SIZE / 4);
+        free_threads(thread, 1);
+    }
+
+    fclose(out);
+    fclose(in);
+}
+
+// nnuebench replays a search-like walk from every position: the first
+// NNUE_BENCH_WIDTH legal moves, captures first, down to NNUE_BENCH_DEPTH
+#define NNUE_BENCH_WIDTH 3
+#define NNUE_BENCH_DEPTH 4
+#define NNUE_BENCH_POSITIONS 256
+
+static void record_walk(position_t *pos, nnue_trace_t *trace, int depth) {
+    if (!depth) {
+        return;
+    }
+    moves move_list[1];
+    generate_noisy(pos, move_list, 0);
+    generate_quiets(pos, move_list, 1);
+
+    int made = 0;
+    for (uint32_t i = 0; i < move_list->count && made < NNUE_BENCH_WIDTH; ++i) {
+        const uint16_t move = move_list->entry[i].move;
+        // room for this move, its unmake and those of the moves below the root
+        if (trace->length + 2 + NNUE_BENCH_DEPTH - depth > NNUE_TRACE_LENGTH) {
+            return;
+        }
+        position_t next = *pos;
+        make_move(&next, move);
+        trace->moves[trace->length++] = move;
+        record_walk(&next, trace, depth - 1);
+        trace->moves[trace->length++] = 0;
+        made++;
+    }
+}
+
+// Times the NNUE kernels on make/unmake sequences recorded from the FENs of
+// in_file, or from the bench positions without one, once for every kernel
+// set the cpu can run
+void nnue_bench_suite(const char *in_file) {
+    FILE *in = NULL;
+    if (in_file && !(in = fopen(in_file, "r"))) {
+        printf("Could not open %s\n", in_file);
+        return;
+    }
+
+    thread_t *thread = init_threads(1);
+    nnue_trace_t *traces = malloc(NNUE_BENCH_POSITIONS * sizeof(nnue_trace_t));
+    if (!thread || !traces) {
+        free(traces);
+        if (thread) {
+            free_threads(thread, 1);
+        }
+        if (in) {
+            fclose(in);
+        }
+        return;
+    }
+
+    int count = 0;
+    uint64_t moves = 0;
+    position_t pos;
+    while (count < NNUE_BENCH_POSITIONS) {
+        if (in) {
+            if (!next_fen_position(in, &pos, thread)) {
+                break;
+            }
+        } else if (count < BENCH_POSITIONS) {
+            char input[256];
+            snprintf(input, sizeof(input), "position fen %s",
+                     bench_positions[count]);
+            parse_position(&pos, thread, input);
+        } else {
+            break;
+        }
+        traces[count].root = pos;
+        traces[count].length = 0;
+        record_walk(&pos, &traces[count], NNUE_BENCH_DEPTH);
+        moves += traces[count].length / 2;
+        count++;
+    }
+
+    printf("%d positions, %" PRIu64 " moves replayed\n", count, moves);
+    nnue_bench_result_t results[NNUE_BENCH_KERNELS];
+    for (int index = 0; count && nnue_use_kernels(index); ++index) {
+        const int kernels = nnue_bench(thread, traces, count, results);
+        printf("\nkernels %s\n", nnue_kernel_name());
+        printf("%-28s %10s %10s %10s\n", "kernel", "ops", "ns/op", "cycles/op");
+        for (int i = 0; i < kernels; ++i) {
+            const uint64_t ops = MAX(results[i].ops, 1);
+            printf("%-28s %10" PRIu64 " %10.1f %10.1f\n", results[i].kernel,
+                   results[i].ops, (double)results[i].ns / ops,
+                   (double)results[i].cycles / ops);
+        }
+    }
+    nnue_use_kernels(-1);
+
+    free(traces);
+    free_threads(thread, 1);
+    if (in) {
+        fclose(in);
+    }
+}
@@ -4,7 +4,11 @@
 #include "structs.h"
 #include <stdint.h>
 
-void genfens(position_t *pos, thread_t *thread, uint64_t seed,
+void genfens(position_t *pos, search_t *search, uint64_t seed,
              uint16_t n_of_fens, const char *bookfile);
+void eval_batch(const char *in_file, const char *out_file, int thread_count);
+void tail_check(const char *in_file);
+void nnz_sample(const char *in_file, const char *out_file);
+void nnue_bench_suite(const char *in_file);
 
 #endif
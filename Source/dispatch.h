@@ -0,0 +1,28 @@
+#ifndef DISPATCH_H
+#define DISPATCH_H
+
+// Fat builds compile the kernel sources (nnue.c, threats.c) once per
+// instruction set with KERNEL_ISA naming the set. Their entry points get the
+// set appended, so every copy links side by side and nnue_dispatch.c picks
+// one of them at startup. Must be included before any other header.
+#ifdef KERNEL_ISA
+#define KERNEL_CONCAT(name, isa) name##_##isa
+#define KERNEL_NAME(name, isa) KERNEL_CONCAT(name, isa)
+
+#define nnue_init KERNEL_NAME(nnue_init, KERNEL_ISA)
+#define init_accumulator KERNEL_NAME(init_accumulator, KERNEL_ISA)
+#define init_finny_tables KERNEL_NAME(init_finny_tables, KERNEL_ISA)
+#define nnue_evaluate KERNEL_NAME(nnue_evaluate, KERNEL_ISA)
+#define nnue_eval_pos KERNEL_NAME(nnue_eval_pos, KERNEL_ISA)
+#define nnue_evaluate_batch KERNEL_NAME(nnue_evaluate_batch, KERNEL_ISA)
+#define nnue_evaluate_tails KERNEL_NAME(nnue_evaluate_tails, KERNEL_ISA)
+#define nnue_l1_activations KERNEL_NAME(nnue_l1_activations, KERNEL_ISA)
+#define update_nnue KERNEL_NAME(update_nnue, KERNEL_ISA)
+#define apply_accumulator KERNEL_NAME(apply_accumulator, KERNEL_ISA)
+#define null_move_copy_accumulator                                             \
+  KERNEL_NAME(null_move_copy_accumulator, KERNEL_ISA)
+#define calculate_threats KERNEL_NAME(calculate_threats, KERNEL_ISA)
+#define nnue_bench KERNEL_NAME(nnue_bench, KERNEL_ISA)
+#endif
+
+#endif
@@ -5,6 +5,7 @@
 #include "spsa.h"
 #include "structs.h"
 #include "utils.h"
+#include <string.h>
 
 TUNABLE(int EVAL_KNIGHT = 384);
 TUNABLE(int EVAL_BISHOP = 384);
@@ -14,9 +15,34 @@ TUNABLE(int EVAL_SCALE_BASE = 25600);
 
 extern uint8_t disable_norm;
 
+// Evaluates pos, taking the network output from the cache when an earlier
+// call already computed it. The cache is direct mapped and private to the
+// thread, so unlike the static eval in the TT its entries are not lost to
+// other threads under pressure. Only the raw output is cached, normalization
+// is applied afterwards so it can change without invalidating entries. A hit
+// leaves the accumulator of the ply dirty, it is only caught up once a later
+// ply is evaluated. Builds without EVAL_CACHE always evaluate.
 int16_t evaluate(thread_t *thread, position_t *pos,
                  accumulator_t *accumulator) {
-  int eval = nnue_evaluate(thread, pos, accumulator);
+  int eval;
+#if EVAL_CACHE_SIZE
+  const uint64_t key = pos->hash_keys.hash_key;
+  uint64_t *entry =
+      &thread->tables->eval_cache[key & (EVAL_CACHE_SIZE - 1)];
+  thread->eval_cache_probes++;
+  if ((*entry ^ key) >> 16 == 0) {
+    thread->eval_cache_hits++;
+    eval = (int16_t)(uint16_t)*entry;
+  } else {
+    eval = nnue_evaluate(thread, pos, accumulator);
+    // outputs that do not fit the entry are recomputed every time
+    if (eval == (int16_t)eval) {
+      *entry = (key & ~0xFFFFULL) | (uint16_t)eval;
+    }
+  }
+#else
+  eval = nnue_evaluate(thread, pos, accumulator);
+#endif
   /*(void)thread;
   int eval = nnue_eval_pos(pos, accumulator);*/
 
@@ -29,6 +55,15 @@ int16_t evaluate(thread_t *thread, position_t *pos,
     eval = eval * (EVAL_SCALE_BASE + phase) / 32768;
   }
 
-  int16_t final_eval = clamp(eval, -MATE_SCORE + 1, MATE_SCORE - 1);
-  return final_eval;
+  return clamp(eval, -MATE_SCORE + 1, MATE_SCORE - 1);
+}
+
+// Forgets every cached eval, needed whenever the same position would now
+// evaluate differently
+void clear_eval_cache(thread_t *thread) {
+#if EVAL_CACHE_SIZE
+  memset(thread->tables->eval_cache, 0, sizeof(thread->tables->eval_cache));
+#else
+  (void)thread;
+#endif
 }
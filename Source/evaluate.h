@@ -4,4 +4,5 @@
 #include "structs.h"
 
 int16_t evaluate(thread_t *thread, position_t *pos, accumulator_t *accumulator);
+void clear_eval_cache(thread_t *thread);
 #endif
@@ -146,15 +146,15 @@ int16_t adjust_static_eval(thread_t *thread, int16_t static_eval) {
       (float)((FIFTY_MOVE_SCALING - (float)pos->fifty) / FIFTY_MOVE_SCALING);
   static_eval = static_eval * fifty_move_scaler;
   const int pawn_correction =
-      thread->correction_history[pos->side][pos->hash_keys.pawn_key & 16383] *
+      thread->tables->correction_history[pos->side][pos->hash_keys.pawn_key & 16383] *
       PAWN_CORR_HISTORY_MULTIPLIER;
   const int white_non_pawn_correction =
-      thread->w_non_pawn_correction_history[pos->side]
+      thread->tables->w_non_pawn_correction_history[pos->side]
                                            [pos->hash_keys.non_pawn_key[white] &
                                             16383] *
       NON_PAWN_CORR_HISTORY_MULTIPLIER;
   const int black_non_pawn_correction =
-      thread->b_non_pawn_correction_history[pos->side]
+      thread->tables->b_non_pawn_correction_history[pos->side]
                                            [pos->hash_keys.non_pawn_key[black] &
                                             16383] *
       NON_PAWN_CORR_HISTORY_MULTIPLIER;
@@ -168,15 +168,15 @@ int16_t adjust_static_eval(thread_t *thread, int16_t static_eval) {
 int16_t correction_value(thread_t *thread) {
   position_t *pos = &thread->positions[thread->ply];
   const int pawn_correction =
-      thread->correction_history[pos->side][pos->hash_keys.pawn_key & 16383] *
+      thread->tables->correction_history[pos->side][pos->hash_keys.pawn_key & 16383] *
       PAWN_CORR_HISTORY_MULTIPLIER;
   const int white_non_pawn_correction =
-      thread->w_non_pawn_correction_history[pos->side]
+      thread->tables->w_non_pawn_correction_history[pos->side]
                                            [pos->hash_keys.non_pawn_key[white] &
                                             16383] *
       NON_PAWN_CORR_HISTORY_MULTIPLIER;
   const int black_non_pawn_correction =
-      thread->b_non_pawn_correction_history[pos->side]
+      thread->tables->b_non_pawn_correction_history[pos->side]
                                            [pos->hash_keys.non_pawn_key[black] &
                                             16383] *
       NON_PAWN_CORR_HISTORY_MULTIPLIER;
@@ -191,25 +191,25 @@ void update_corrhist(thread_t *thread, int16_t static_eval, int16_t score,
   position_t *pos = &thread->positions[thread->ply];
   int16_t bonus = calculate_corrhist_bonus(static_eval, score, depth);
 
-  thread->correction_history[pos->side][pos->hash_keys.pawn_key & 16383] +=
+  thread->tables->correction_history[pos->side][pos->hash_keys.pawn_key & 16383] +=
       scale_corrhist_bonus(
           thread
-              ->correction_history[pos->side][pos->hash_keys.pawn_key & 16383],
+              ->tables->correction_history[pos->side][pos->hash_keys.pawn_key & 16383],
           bonus);
 
-  thread->w_non_pawn_correction_history[pos->side]
+  thread->tables->w_non_pawn_correction_history[pos->side]
                                        [pos->hash_keys.non_pawn_key[white] &
                                         16383] +=
       scale_corrhist_bonus(
-          thread->w_non_pawn_correction_history
+          thread->tables->w_non_pawn_correction_history
               [pos->side][pos->hash_keys.non_pawn_key[white] & 16383],
           bonus);
 
-  thread->b_non_pawn_correction_history[pos->side]
+  thread->tables->b_non_pawn_correction_history[pos->side]
                                        [pos->hash_keys.non_pawn_key[black] &
                                         16383] +=
       scale_corrhist_bonus(
-          thread->b_non_pawn_correction_history
+          thread->tables->b_non_pawn_correction_history
               [pos->side][pos->hash_keys.non_pawn_key[black] & 16383],
           bonus);
 }
@@ -219,10 +219,10 @@ void update_quiet_history(thread_t *thread, searchstack_t *ss, int move,
   position_t *pos = &thread->positions[thread->ply];
   int target = get_history_target(move);
   int source = get_move_source(move);
-  thread->quiet_history[pos->side][source][target][is_square_threatened(
+  thread->tables->quiet_history[pos->side][source][target][is_square_threatened(
       ss, source)][is_square_threatened(ss, target)] +=
       bonus -
-      thread->quiet_history[pos->side][source][target][is_square_threatened(
+      thread->tables->quiet_history[pos->side][source][target][is_square_threatened(
           ss, source)][is_square_threatened(ss, target)] *
           abs(bonus) / HISTORY_MAX;
 }
@@ -237,11 +237,11 @@ void update_capture_history(thread_t *thread, searchstack_t *ss, int move,
                           : pos->side ? pos->mailbox[get_move_target(move) - 8]
                                       : pos->mailbox[get_move_target(move) + 8];
 
-  thread->capture_history[pos->mailbox[from]][prev_target_piece][target]
+  thread->tables->capture_history[pos->mailbox[from]][prev_target_piece][target]
                          [is_square_threatened(ss, from)]
                          [is_square_threatened(ss, target)] +=
       bonus -
-      thread->capture_history[pos->mailbox[from]][prev_target_piece]
+      thread->tables->capture_history[pos->mailbox[from]][prev_target_piece]
                              [target][is_square_threatened(ss, from)]
                              [is_square_threatened(ss, target)] *
           abs(bonus) / HISTORY_MAX;
@@ -269,9 +269,9 @@ void update_pawn_history(thread_t *thread, int move, int bonus) {
   position_t *pos = &thread->positions[thread->ply];
   int target = get_history_target(move);
   int source = get_move_source(move);
-  thread->pawn_history[pos->hash_keys.pawn_key % 2048][pos->mailbox[source]]
+  thread->tables->pawn_history[pos->hash_keys.pawn_key % 2048][pos->mailbox[source]]
                       [target] +=
-      bonus - thread->pawn_history[pos->hash_keys.pawn_key % 2048]
+      bonus - thread->tables->pawn_history[pos->hash_keys.pawn_key % 2048]
                                   [pos->mailbox[source]][target] *
                   abs(bonus) / HISTORY_MAX;
 }
@@ -10,6 +10,7 @@
 #ifndef INCBIN_HDR
 #define INCBIN_HDR
 #include <limits.h>
+#ifndef INCBIN_ALIGNMENT_INDEX
 #if defined(__AVX512BW__) || defined(__AVX512CD__) || defined(__AVX512DQ__) || \
     defined(__AVX512ER__) || defined(__AVX512PF__) || defined(__AVX512VL__) || \
     defined(__AVX512F__)
@@ -25,6 +26,7 @@
 #else
 #define INCBIN_ALIGNMENT_INDEX 2
 #endif
+#endif
 
 /* Lookup table of (1 << n) where `n' is `INCBIN_ALIGNMENT_INDEX' */
 #define INCBIN_ALIGN_SHIFT_0 1
@@ -407,13 +407,71 @@ void add_move(moves *move_list, int move) {
   move_list->count++;
 }
 
+// The generators only emit legal moves. Outside double check every move but
+// a king move has to land on check_mask, which is the whole board when the
+// side to move is not in check and the checker plus the squares between it
+// and the king in single check. Pinned pieces also have to stay on the line
+// through their king. In double check only the king moves.
+typedef struct {
+  uint64_t check_mask;
+  uint64_t pinned;
+  uint8_t king;
+} legal_masks_t;
+
+static inline legal_masks_t get_legal_masks(position_t *pos) {
+  legal_masks_t legal;
+  legal.king = get_lsb(pos->bitboards[KING + 6 * pos->side]);
+  legal.pinned = pos->blockers[pos->side] & pos->occupancies[pos->side];
+  legal.check_mask = !pos->checkers ? ~0ULL
+                     : pos->checker_count > 1
+                         ? 0ULL
+                         : between[legal.king][get_lsb(pos->checkers)];
+  return legal;
+}
+
+// legal targets of the non king piece on source among attacks
+static inline uint64_t legal_targets(const legal_masks_t *legal, int source,
+                                     uint64_t attacks) {
+  attacks &= legal->check_mask;
+  if (legal->pinned & BB(source))
+    attacks &= line[legal->king][source];
+  return attacks;
+}
+
+// targets among attacks the king is not attacked on, looking through the
+// square it leaves so it cannot step back along the ray of a checker
+static inline uint64_t safe_king_targets(position_t *pos, int king,
+                                         uint64_t attacks) {
+  const uint64_t occupied = pos->occupancies[both] ^ BB(king);
+  uint64_t safe = 0;
+  while (attacks) {
+    const int target_square = poplsb(&attacks);
+    if (!(attackers_to(pos, target_square, occupied) &
+          pos->occupancies[pos->side ^ 1]))
+      safe |= BB(target_square);
+  }
+  return safe;
+}
+
+// en passant takes two pieces off the board at once, so it is checked on
+// the resulting occupancy rather than with the masks
+static inline uint8_t is_enpassant_legal(position_t *pos, int king,
+                                         int source_square, int target_square) {
+  const int ep_square = target_square - (pos->side ? 8 : -8);
+  const uint64_t occupied =
+      (pos->occupancies[both] ^ BB(source_square) ^ BB(ep_square)) |
+      BB(target_square);
+  return !(attackers_to(pos, king, occupied) &
+           pos->occupancies[pos->side ^ 1] & ~BB(ep_square));
+}
+
 // generate only quiet moves
 void generate_quiets(position_t *pos, moves *move_list, uint8_t no_reset) {
   if (!no_reset)
     move_list->count = 0;
 
   int source_square, target_square;
-  uint64_t bitboard, attacks;
+  uint64_t bitboard, attacks, singles, doubles;
 
   const uint8_t PAWN_PC   = pos->side == white ? P : p;
   const uint8_t KNIGHT_PC = pos->side == white ? N : n;
@@ -428,22 +486,30 @@ void generate_quiets(position_t *pos, moves *move_list, uint8_t no_reset) {
   const uint64_t start_mask = pos->side == white ? RANK2_MASK : RANK7_MASK;
   const uint64_t pawns      = pos->bitboards[PAWN_PC];
 
+  const legal_masks_t legal = get_legal_masks(pos);
+  if (pos->checker_count > 1)
+    goto king_moves;
+
   // pawns
-  uint64_t singles = pos->side == white
+  singles = pos->side == white
       ? ((pawns & ~promo_mask) >> 8) & empty
       : ((pawns & ~promo_mask) << 8) & empty;
+  singles &= legal.check_mask;
   while (singles) {
     target_square = __builtin_ctzll(singles);
-    add_move(move_list, encode_move(target_square - step, target_square, QUIET));
+    if (legal_targets(&legal, target_square - step, BB(target_square)))
+      add_move(move_list, encode_move(target_square - step, target_square, QUIET));
     pop_bit(singles, target_square);
   }
 
-  uint64_t doubles = pos->side == white
+  doubles = pos->side == white
       ? (((pawns & start_mask) >> 8) & empty) >> 8 & empty
       : (((pawns & start_mask) << 8) & empty) << 8 & empty;
+  doubles &= legal.check_mask;
   while (doubles) {
     target_square = __builtin_ctzll(doubles);
-    add_move(move_list, encode_move(target_square - 2 * step, target_square, DOUBLE_PUSH));
+    if (legal_targets(&legal, target_square - 2 * step, BB(target_square)))
+      add_move(move_list, encode_move(target_square - 2 * step, target_square, DOUBLE_PUSH));
     pop_bit(doubles, target_square);
   }
 
@@ -451,7 +517,8 @@ void generate_quiets(position_t *pos, moves *move_list, uint8_t no_reset) {
   bitboard = pos->bitboards[KNIGHT_PC];
   while (bitboard) {
     source_square = __builtin_ctzll(bitboard);
-    attacks = knight_attacks[source_square] & empty;
+    attacks = legal_targets(&legal, source_square,
+                            knight_attacks[source_square] & empty);
     while (attacks) {
       target_square = __builtin_ctzll(attacks);
       add_move(move_list, encode_move(source_square, target_square, QUIET));
@@ -464,7 +531,8 @@ void generate_quiets(position_t *pos, moves *move_list, uint8_t no_reset) {
   bitboard = pos->bitboards[BISHOP_PC];
   while (bitboard) {
     source_square = __builtin_ctzll(bitboard);
-    attacks = get_bishop_attacks(source_square, pos->occupancies[both]) & empty;
+    attacks = legal_targets(&legal, source_square,
+                            get_bishop_attacks(source_square, pos->occupancies[both]) & empty);
     while (attacks) {
       target_square = __builtin_ctzll(attacks);
       add_move(move_list, encode_move(source_square, target_square, QUIET));
@@ -477,7 +545,8 @@ void generate_quiets(position_t *pos, moves *move_list, uint8_t no_reset) {
   bitboard = pos->bitboards[ROOK_PC];
   while (bitboard) {
     source_square = __builtin_ctzll(bitboard);
-    attacks = get_rook_attacks(source_square, pos->occupancies[both]) & empty;
+    attacks = legal_targets(&legal, source_square,
+                            get_rook_attacks(source_square, pos->occupancies[both]) & empty);
     while (attacks) {
       target_square = __builtin_ctzll(attacks);
       add_move(move_list, encode_move(source_square, target_square, QUIET));
@@ -490,7 +559,8 @@ void generate_quiets(position_t *pos, moves *move_list, uint8_t no_reset) {
   bitboard = pos->bitboards[QUEEN_PC];
   while (bitboard) {
     source_square = __builtin_ctzll(bitboard);
-    attacks = get_queen_attacks(source_square, pos->occupancies[both]) & empty;
+    attacks = legal_targets(&legal, source_square,
+                            get_queen_attacks(source_square, pos->occupancies[both]) & empty);
     while (attacks) {
       target_square = __builtin_ctzll(attacks);
       add_move(move_list, encode_move(source_square, target_square, QUIET));
@@ -499,11 +569,13 @@ void generate_quiets(position_t *pos, moves *move_list, uint8_t no_reset) {
     pop_bit(bitboard, source_square);
   }
 
+king_moves:
   // king moves
   bitboard = pos->bitboards[KING_PC];
   while (bitboard) {
     source_square = __builtin_ctzll(bitboard);
-    attacks = king_attacks[source_square] & empty;
+    attacks = safe_king_targets(pos, source_square,
+                                king_attacks[source_square] & empty);
     while (attacks) {
       target_square = __builtin_ctzll(attacks);
       add_move(move_list, encode_move(source_square, target_square, QUIET));
@@ -512,10 +584,10 @@ void generate_quiets(position_t *pos, moves *move_list, uint8_t no_reset) {
     pop_bit(bitboard, source_square);
   }
 
-  // castling
+  // castling, never out of check
   const uint8_t stm = pos->side;
-  const uint8_t ksq = get_lsb(pos->bitboards[KING + 6 * stm]);
-  for (uint8_t cs = 0; cs < 2; ++cs) {
+  const uint8_t ksq = legal.king;
+  for (uint8_t cs = 0; cs < 2 && !pos->checkers; ++cs) {
     if (!(pos->castle & castle_bit(stm, cs)))
       continue;
     const uint8_t rsq   = pos->castle_rook_sq[stm][cs];
@@ -567,6 +639,10 @@ void generate_noisy(position_t *pos, moves *move_list, uint8_t no_reset) {
   const int      step       = pos->side == white ? -8 : 8;
   const uint64_t promo_mask = pos->side == white ? RANK7_MASK : RANK2_MASK;
 
+  const legal_masks_t legal = get_legal_masks(pos);
+  if (pos->checker_count > 1)
+    goto king_moves;
+
   // pawns
   bitboard = pos->bitboards[PAWN_PC];
   while (bitboard) {
@@ -574,14 +650,16 @@ void generate_noisy(position_t *pos, moves *move_list, uint8_t no_reset) {
     target_square = source_square + step;
 
     if ((BB(source_square) & promo_mask) &&
-        !get_bit(pos->occupancies[both], target_square)) {
+        !get_bit(pos->occupancies[both], target_square) &&
+        legal_targets(&legal, source_square, BB(target_square))) {
       add_move(move_list, encode_move(source_square, target_square, QUEEN_PROMOTION));
       add_move(move_list, encode_move(source_square, target_square, ROOK_PROMOTION));
       add_move(move_list, encode_move(source_square, target_square, BISHOP_PROMOTION));
       add_move(move_list, encode_move(source_square, target_square, KNIGHT_PROMOTION));
     }
 
-    attacks = pawn_attacks[pos->side][source_square] & enemy;
+    attacks = legal_targets(&legal, source_square,
+                            pawn_attacks[pos->side][source_square] & enemy);
     while (attacks) {
       target_square = __builtin_ctzll(attacks);
       if (BB(source_square) & promo_mask) {
@@ -597,7 +675,8 @@ void generate_noisy(position_t *pos, moves *move_list, uint8_t no_reset) {
 
     if (pos->enpassant != no_sq) {
       uint64_t ep = pawn_attacks[pos->side][source_square] & (1ULL << pos->enpassant);
-      if (ep)
+      if (ep && is_enpassant_legal(pos, legal.king, source_square,
+                                   pos->enpassant))
         add_move(move_list, encode_move(source_square, __builtin_ctzll(ep), ENPASSANT_CAPTURE));
     }
 
@@ -608,7 +687,8 @@ void generate_noisy(position_t *pos, moves *move_list, uint8_t no_reset) {
   bitboard = pos->bitboards[KNIGHT_PC];
   while (bitboard) {
     source_square = __builtin_ctzll(bitboard);
-    attacks = knight_attacks[source_square] & enemy;
+    attacks = legal_targets(&legal, source_square,
+                            knight_attacks[source_square] & enemy);
     while (attacks) {
       target_square = __builtin_ctzll(attacks);
       add_move(move_list, encode_move(source_square, target_square, CAPTURE));
@@ -621,7 +701,8 @@ void generate_noisy(position_t *pos, moves *move_list, uint8_t no_reset) {
   bitboard = pos->bitboards[BISHOP_PC];
   while (bitboard) {
     source_square = __builtin_ctzll(bitboard);
-    attacks = get_bishop_attacks(source_square, pos->occupancies[both]) & enemy;
+    attacks = legal_targets(&legal, source_square,
+                            get_bishop_attacks(source_square, pos->occupancies[both]) & enemy);
     while (attacks) {
       target_square = __builtin_ctzll(attacks);
       add_move(move_list, encode_move(source_square, target_square, CAPTURE));
@@ -634,7 +715,8 @@ void generate_noisy(position_t *pos, moves *move_list, uint8_t no_reset) {
   bitboard = pos->bitboards[ROOK_PC];
   while (bitboard) {
     source_square = __builtin_ctzll(bitboard);
-    attacks = get_rook_attacks(source_square, pos->occupancies[both]) & enemy;
+    attacks = legal_targets(&legal, source_square,
+                            get_rook_attacks(source_square, pos->occupancies[both]) & enemy);
     while (attacks) {
       target_square = __builtin_ctzll(attacks);
       add_move(move_list, encode_move(source_square, target_square, CAPTURE));
@@ -647,7 +729,8 @@ void generate_noisy(position_t *pos, moves *move_list, uint8_t no_reset) {
   bitboard = pos->bitboards[QUEEN_PC];
   while (bitboard) {
     source_square = __builtin_ctzll(bitboard);
-    attacks = get_queen_attacks(source_square, pos->occupancies[both]) & enemy;
+    attacks = legal_targets(&legal, source_square,
+                            get_queen_attacks(source_square, pos->occupancies[both]) & enemy);
     while (attacks) {
       target_square = __builtin_ctzll(attacks);
       add_move(move_list, encode_move(source_square, target_square, CAPTURE));
@@ -656,11 +739,13 @@ void generate_noisy(position_t *pos, moves *move_list, uint8_t no_reset) {
     pop_bit(bitboard, source_square);
   }
 
+king_moves:
   // king
   bitboard = pos->bitboards[KING_PC];
   while (bitboard) {
     source_square = __builtin_ctzll(bitboard);
-    attacks = king_attacks[source_square] & enemy;
+    attacks = safe_king_targets(pos, source_square,
+                                king_attacks[source_square] & enemy);
     while (attacks) {
       target_square = __builtin_ctzll(attacks);
       add_move(move_list, encode_move(source_square, target_square, CAPTURE));
@@ -0,0 +1,190 @@
+#include "nnue.h"
+// nnue_t is 64 byte aligned whatever instruction set this file is built for,
+// the avx512 copies of the kernels of a fat build rely on it
+#define INCBIN_ALIGNMENT_INDEX 6
+#include "incbin/incbin.h"
+#include "numa.h"
+#include "utils.h"
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// The network and the state shared by every copy of the NNUE kernels. Kept
+// apart from nnue.c so fat builds, which compile nnue.c once per instruction
+// set, embed the weights only once.
+
+int EVAL_SCALE = 298;
+
+#if !defined(_MSC_VER)
+INCBIN(EVAL, EVALFILE);
+#else
+const unsigned char gEVALData[1] = {};
+const unsigned char *const gEVALEnd = &gEVALData[1];
+const unsigned int gEVALSize = 1;
+#endif
+
+// The embedded network, moved to a copy on large pages by
+// nnue_use_large_pages when one can be made
+static const nnue_t *embedded = (const nnue_t *)gEVALData;
+static size_t embedded_size = 0;
+static uint8_t embedded_pages = SMALL_PAGES;
+
+// The network new searches evaluate with, the embedded one unless EvalFile
+// mapped another
+static const nnue_t *network = (const nnue_t *)gEVALData;
+static uint64_t network_hash = 0;
+static char network_name[4096] = NETWORK_NAME;
+static void *network_map = NULL;
+
+// Thread local so NUMA bound threads can read a replica on their own node,
+// every other thread uses the active network. Threads pick it up in
+// numa_bind_thread.
+_Thread_local const nnue_t *nnue = (const nnue_t *)gEVALData;
+
+const nnue_t *nnue_network(void) { return network; }
+
+// Copies the embedded network out of the binary, whose read only data sits
+// on 4 KiB pages, into memory on huge pages, so the random rows read by
+// accumulator updates stop missing the TLB. Keeps using the binary's copy
+// when no memory is left. Call before any thread evaluates.
+void nnue_use_large_pages(void) {
+  if (embedded != (const nnue_t *)gEVALData ||
+      gEVALSize < sizeof(nnue_t)) {
+    return;
+  }
+  void *copy = alloc_large(gEVALSize, &embedded_pages);
+  if (!copy) {
+    return;
+  }
+  memcpy(copy, gEVALData, gEVALSize);
+  embedded_size = gEVALSize;
+  if (network == (const nnue_t *)gEVALData) {
+    network = copy;
+    nnue = network;
+  }
+  embedded = copy;
+}
+
+// Describes the memory the active network lives in
+const char *nnue_network_pages(void) {
+  static char pages[96];
+  if (network_map) {
+    snprintf(pages, sizeof(pages), "a shared mapping of %s", network_name);
+  } else if (embedded == (const nnue_t *)gEVALData) {
+    snprintf(pages, sizeof(pages), "4 KiB pages of the binary");
+  } else if (embedded_pages == TRANSPARENT_HUGE_PAGES) {
+    // the copy is mapped in whole 2 MiB blocks
+    snprintf(pages, sizeof(pages), "%s (%" PRIu64 " of %zu MiB)",
+             page_kind(embedded_pages), huge_page_bytes(embedded) >> 20,
+             ((embedded_size + (2 << 20) - 1) >> 21) << 1);
+  } else {
+    snprintf(pages, sizeof(pages), "%s", page_kind(embedded_pages));
+  }
+  return pages;
+}
+
+const char *nnue_network_name(void) { return network_name; }
+
+// Identifies the active network
+uint64_t nnue_hash(void) {
+  if (!network_hash) {
+    const nnue_footer_t *footer = (const nnue_footer_t *)(network + 1);
+    network_hash = gEVALSize >= sizeof(nnue_t) + sizeof(nnue_footer_t) &&
+                           footer->magic == NNUE_FILE_MAGIC
+                       ? footer->hash
+                       : hash_bytes(network, sizeof(nnue_t));
+  }
+  return network_hash;
+}
+
+// Maps a file written by Tools/process_net and makes it the active network.
+// The mapping is shared and read only, so every engine process using the
+// same file evaluates from one copy in the page cache. An empty path or
+// <embedded> goes back to the network built into the binary. Must not be
+// called while anything is evaluating.
+int nnue_load_network(const char *path) {
+  const nnue_t *loaded = embedded;
+  uint64_t loaded_hash = 0;
+  void *map = NULL;
+
+  if (*path && strcmp(path, "<embedded>") != 0) {
+#ifdef _WIN32
+    printf("info string EvalFile is not supported on this platform\n");
+    return 0;
+#else
+    const size_t size = sizeof(nnue_t) + sizeof(nnue_footer_t);
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+      printf("info string Could not open %s\n", path);
+      return 0;
+    }
+
+    struct stat st;
+    const char *error = NULL;
+    if (fstat(fd, &st) != 0 || (uint64_t)st.st_size != size) {
+      error = "does not have the size of a network for this build";
+    } else {
+      map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+      if (map == MAP_FAILED) {
+        map = NULL;
+        error = "could not be mapped";
+      }
+    }
+    close(fd);
+
+    if (map) {
+      // only takes effect where the kernel can back file pages with huge
+      // pages, it is a hint everywhere else
+      madvise(map, size, MADV_HUGEPAGE);
+
+      const nnue_footer_t *footer =
+          (const nnue_footer_t *)((const char *)map + sizeof(nnue_t));
+      if (footer->magic != NNUE_FILE_MAGIC) {
+        error = "is not a processed network";
+      } else if (footer->layout != NNUE_FILE_LAYOUT) {
+        error = "was processed for a different build";
+      } else if (footer->hash != hash_bytes(map, sizeof(nnue_t))) {
+        error = "is corrupt";
+      }
+    }
+
+    if (error) {
+      printf("info string Network file %s %s\n", path, error);
+      if (map) {
+        munmap(map, size);
+      }
+      return 0;
+    }
+
+    loaded = (const nnue_t *)map;
+    loaded_hash = ((const nnue_footer_t *)(loaded + 1))->hash;
+#endif
+  }
+
+  // nothing evaluates right now, so the old weights and any replicas of
+  // them can go
+  numa_free_replicas();
+#ifndef _WIN32
+  if (network_map) {
+    munmap(network_map, sizeof(nnue_t) + sizeof(nnue_footer_t));
+  }
+#endif
+  network_map = map;
+  network = loaded;
+  network_hash = loaded_hash;
+  snprintf(network_name, sizeof(network_name), "%s",
+           map ? path : NETWORK_NAME);
+  nnue = network;
+
+  printf("info string NNUE evaluation using %s (%016" PRIx64 ")\n",
+         network_name, nnue_hash());
+  return 1;
+}
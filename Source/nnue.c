@@ -1,10 +1,11 @@
+#include "dispatch.h"
 #include "nnue.h"
 #include "arch.h"
 #include "attacks.h"
 #include "bitboards.h"
 #include "enums.h"
-#include "incbin/incbin.h"
 #include "move.h"
+#include "movegen.h"
 #include "simd.h"
 #include "structs.h"
 #include "utils.h"
@@ -13,12 +14,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
-int EVAL_SCALE = 298;
-
-const nnue_t *nnue;
-
-const int INT8_PER_INT32 = sizeof(int) / sizeof(int8_t);
+static const int INT8_PER_INT32 = sizeof(int) / sizeof(int8_t);
 
 static int feature_base_lut[12][12][2];
 static uint8_t precomputed_piece_index[12][64][64];
@@ -52,19 +53,11 @@ static void init_nnz_table(void) {
 
 #define GCC_VERSION (__GNUC__ * 10000 + __GNUC_MINOR__ * 100 + __GNUC_PATCHLEVEL__)
 
-const uint8_t buckets[64] = {14, 14, 15, 15, 15, 15, 14, 14, 14, 14, 15, 15, 15,
-                             15, 14, 14, 12, 12, 13, 13, 13, 13, 12, 12, 12, 12,
-                             13, 13, 13, 13, 12, 12, 8,  9,  10, 11, 11, 10, 9,
-                             8,  8,  9,  10, 11, 11, 10, 9,  8,  4,  5,  6,  7,
-                             7,  6,  5,  4,  0,  1,  2,  3,  3,  2,  1,  0};
-
-#if !defined(_MSC_VER)
-INCBIN(EVAL, EVALFILE);
-#else
-const unsigned char gEVALData[1] = {};
-const unsigned char *const gEVALEnd = &gEVALData[1];
-const unsigned int gEVALSize = 1;
-#endif
+static const uint8_t buckets[64] = {14, 14, 15, 15, 15, 15, 14, 14, 14, 14, 15, 15, 15,
+                                    15, 14, 14, 12, 12, 13, 13, 13, 13, 12, 12, 12, 12,
+                                    13, 13, 13, 13, 12, 12, 8,  9,  10, 11, 11, 10, 9,
+                                    8,  8,  9,  10, 11, 11, 10, 9,  8,  4,  5,  6,  7,
+                                    7,  6,  5,  4,  0,  1,  2,  3,  3,  2,  1,  0};
 
 #if defined(__AVX512F__) || defined(USE_AVX512)
 #define VECTOR_BYTES 64
@@ -92,7 +85,47 @@ typedef int16_t vec_s16
 typedef int8_t vec_s8
     __attribute__((__vector_size__(CHUNK_ELTS * sizeof(int8_t))));
 
-const uint8_t BUCKET_DIVISOR = (32 + OUTPUT_BUCKETS - 1) / OUTPUT_BUCKETS;
+// Widens the threat weights of a feature to int16 for the CHUNK_SIZE
+// registers starting at column i
+static inline void load_threats(int index, int i, vec_s16 *out) {
+#ifdef NNUE_THREAT_INT4
+  typedef uint8_t vec_u8
+      __attribute__((__vector_size__(CHUNK_ELTS * sizeof(uint8_t))));
+  const uint8_t *row = nnue->feature_threats[index];
+  const uint8_t *shifts = nnue->threat_shifts[index];
+
+#pragma GCC unroll 16
+  for (int k = 0; k < CHUNK_SIZE; ++k) {
+    const int column = i + k * CHUNK_ELTS;
+    const int block = column / THREAT_BLOCK;
+    const uint8_t *bytes = row + block * (THREAT_BLOCK / 2);
+#if VECTOR_BYTES > THREAT_BLOCK
+    // a register holds a whole block, both nibbles of its bytes
+    typedef uint8_t vec_u8_half
+        __attribute__((__vector_size__(THREAT_BLOCK / 2)));
+    vec_u8_half packed;
+    memcpy(&packed, bytes, sizeof(packed));
+    const vec_u8 nibbles = __builtin_shufflevector(
+        packed & 15, packed >> 4, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13,
+        14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31);
+#else
+    const int offset = column % THREAT_BLOCK;
+    vec_u8 packed;
+    memcpy(&packed, bytes + offset % (THREAT_BLOCK / 2), sizeof(packed));
+    const vec_u8 nibbles =
+        offset < THREAT_BLOCK / 2 ? (vec_u8)(packed & 15) : packed >> 4;
+#endif
+    const vec_s8 weights = (vec_s8)(nibbles ^ 8) - 8;
+    out[k] = __builtin_convertvector(weights, vec_s16) << shifts[block];
+  }
+#else
+  const vec_s8 *m = (const vec_s8 *)&nnue->feature_threats[index][i];
+#pragma GCC unroll 16
+  for (int k = 0; k < CHUNK_SIZE; ++k) {
+    out[k] = __builtin_convertvector(m[k], vec_s16);
+  }
+#endif
+}
 
 static inline uint8_t get_king_bucket(uint8_t side, uint8_t square) {
   return buckets[side ? square ^ 56 : square];
@@ -112,12 +145,12 @@ static inline float crelu_float(float value) {
   return clamp_float(value, 0.0f, 1.0f);
 }
 
-#ifndef USE_SIMD
-static int32_t clamp_int32(int32_t d, int32_t min, int32_t max) {
+static inline int32_t clamp_int32(int32_t d, int32_t min, int32_t max) {
   const int32_t t = d < min ? min : d;
   return t > max ? max : t;
 }
 
+#ifndef USE_SIMD
 static inline int32_t screlu(int16_t value) {
   const int32_t clipped = clamp_int32((int32_t)value, 0, INPUT_QUANT);
   return clipped * clipped;
@@ -221,7 +254,6 @@ static inline int get_threat_index(int perspective, int king_sq,
 }
 
 void nnue_init(void) {
-  nnue = (const nnue_t *)gEVALData;
   init_threat_tables();
 #if defined(USE_SIMD) && !defined(USE_AVX512ICL)
   init_nnz_table();
@@ -253,12 +285,15 @@ static inline int16_t get_idx(uint8_t side, uint8_t piece, uint8_t square,
 static void maybe_push_white_threat(threat_list_t*, int);
 static void maybe_push_black_threat(threat_list_t*, int);
 
-void rebuild_threats(position_t *pos, uint8_t *mailbox, accumulator_t *acc) {
+// Collects the threat features of both perspectives of a position
+static void collect_threats(position_t *pos, uint8_t *mailbox,
+                            threat_list_t *features) {
   uint64_t occ = pos->occupancies[both];
   uint8_t white_king_sq = get_lsb(pos->bitboards[K]);
   uint8_t black_king_sq = get_lsb(pos->bitboards[k]);
 
-  threat_list_t added = { .w_count = 0, .b_count = 0 };
+  features->w_count = 0;
+  features->b_count = 0;
 
   for (int c = 0; c < 2; ++c) {
     for (int pt = 0; pt < 5; ++pt) {
@@ -294,66 +329,123 @@ void rebuild_threats(position_t *pos, uint8_t *mailbox, accumulator_t *acc) {
           int b_idx =
               get_threat_index(black, black_king_sq, pc, victim_pc, src, dest);
 
-          maybe_push_white_threat(&added, w_idx);
-          maybe_push_black_threat(&added, b_idx);
+          maybe_push_white_threat(features, w_idx);
+          maybe_push_black_threat(features, b_idx);
         }
       }
     }
   }
+}
 
-  if (added.w_count) {
+// Sums the threat rows of a list of features into one perspective
+static void sum_threats(const int *indices, int count, int16_t *out) {
+  if (count) {
     for (int i = 0; i < L1_SIZE; i += CHUNK_SIZE * CHUNK_ELTS) {
       vec_s16 vecs[CHUNK_SIZE];
 
-      const vec_s8* m = (const vec_s8 *)&nnue->feature_threats[added.w_idx[0]][i];
-
-#pragma GCC unroll 16
-      for (int k = 0; k < CHUNK_SIZE; ++k) {
-        vec_s8 w8 = *m++;
-        vecs[k] = __builtin_convertvector(w8, vec_s16);
-      }
+      load_threats(indices[0], i, vecs);
 
-      for (int j = 1; j < added.w_count; ++j) {
-        const vec_s8* m = (const vec_s8 *)&nnue->feature_threats[added.w_idx[j]][i];
+      for (int j = 1; j < count; ++j) {
+        vec_s16 w[CHUNK_SIZE];
+        load_threats(indices[j], i, w);
 #pragma GCC unroll 16
         for (int k = 0; k < CHUNK_SIZE; ++k) {
-          vec_s8 w8 = *m++;
-          vecs[k] += __builtin_convertvector(w8, vec_s16);
+          vecs[k] += w[k];
         }
       }
 
-      memcpy(&acc->threat_accumulator[white][i], vecs, sizeof(vecs));
+      memcpy(&out[i], vecs, sizeof(vecs));
     }
   } else
     for (int i = 0; i < L1_SIZE; ++i)
-      acc->threat_accumulator[white][i] = 0;
+      out[i] = 0;
+}
+
+static void rebuild_threats(position_t *pos, uint8_t *mailbox, accumulator_t *acc) {
+  threat_list_t features;
+  collect_threats(pos, mailbox, &features);
+  sum_threats(features.w_idx, features.w_count, acc->threat_accumulator[white]);
+  sum_threats(features.b_idx, features.b_count, acc->threat_accumulator[black]);
+}
+
+// Rebuilds the threat half of one perspective from the threat finny entry of
+// its king mirror. The sorted feature lists are merged, so only the features
+// that differ from that entry are applied. When the entry is further away
+// from the position than an empty accumulator, the features are summed from
+// scratch instead, which is the only case counted as a full rebuild.
+static void refresh_threats(thread_t *thread, position_t *pos,
+                            const threat_list_t *features,
+                            accumulator_t *accumulator, uint8_t side) {
+  const uint8_t king_square = get_lsb(pos->bitboards[side == white ? K : k]);
+  threat_finny_table_t *entry =
+      &thread->tables->threat_finny_tables[(king_square & 7) >= 4][side];
+  const int count = side == white ? features->w_count : features->b_count;
+  int current[256];
+  int added[256];
+  int removed[256];
+  int added_count = 0;
+  int removed_count = 0;
+
+  memcpy(current, side == white ? features->w_idx : features->b_idx,
+         count * sizeof(int));
+  for (int i = 1; i < count; ++i) {
+    const int index = current[i];
+    int j = i;
+    for (; j > 0 && current[j - 1] > index; --j)
+      current[j] = current[j - 1];
+    current[j] = index;
+  }
 
-  if (added.b_count) {
+  int i = 0, j = 0;
+  while (i < count && j < entry->count) {
+    if (current[i] < entry->indices[j])
+      added[added_count++] = current[i++];
+    else if (current[i] > entry->indices[j])
+      removed[removed_count++] = entry->indices[j++];
+    else
+      i++, j++;
+  }
+  while (i < count)
+    added[added_count++] = current[i++];
+  while (j < entry->count)
+    removed[removed_count++] = entry->indices[j++];
+
+  thread->threat_refreshes++;
+
+  if (added_count + removed_count >= count) {
+    thread->threat_rebuilds++;
+    sum_threats(current, count, entry->accumulator);
+  } else {
     for (int i = 0; i < L1_SIZE; i += CHUNK_SIZE * CHUNK_ELTS) {
       vec_s16 vecs[CHUNK_SIZE];
+      memcpy(vecs, &entry->accumulator[i], sizeof(vecs));
 
-      const vec_s8* m = (const vec_s8 *)&nnue->feature_threats[added.b_idx[0]][i];
-
+      for (int j = 0; j < added_count; ++j) {
+        vec_s16 w[CHUNK_SIZE];
+        load_threats(added[j], i, w);
 #pragma GCC unroll 16
-      for (int k = 0; k < CHUNK_SIZE; ++k) {
-        vec_s8 w8 = *m++;
-        vecs[k] = __builtin_convertvector(w8, vec_s16);
+        for (int k = 0; k < CHUNK_SIZE; ++k) {
+          vecs[k] += w[k];
+        }
       }
 
-      for (int j = 1; j < added.b_count; ++j) {
-        const vec_s8* m = (const vec_s8 *)&nnue->feature_threats[added.b_idx[j]][i];
+      for (int j = 0; j < removed_count; ++j) {
+        vec_s16 w[CHUNK_SIZE];
+        load_threats(removed[j], i, w);
 #pragma GCC unroll 16
         for (int k = 0; k < CHUNK_SIZE; ++k) {
-          vec_s8 w8 = *m++;
-          vecs[k] += __builtin_convertvector(w8, vec_s16);
+          vecs[k] -= w[k];
         }
       }
 
-      memcpy(&acc->threat_accumulator[black][i], vecs, sizeof(vecs));
+      memcpy(&entry->accumulator[i], vecs, sizeof(vecs));
     }
-  } else
-    for (int i = 0; i < L1_SIZE; ++i)
-      acc->threat_accumulator[black][i] = 0;
+  }
+
+  memcpy(accumulator->threat_accumulator[side], entry->accumulator,
+         sizeof(entry->accumulator));
+  memcpy(entry->indices, current, count * sizeof(int));
+  entry->count = count;
 }
 
 typedef struct psqt_list_s {
@@ -361,16 +453,17 @@ typedef struct psqt_list_s {
   unsigned indices[32];
 } psqt_list_t;
 
-static inline void refresh_accumulator(thread_t *thread, position_t *pos,
-                                       accumulator_t *accumulator) {
-  const uint8_t side = pos->side ^ 1;
+// Rebuilds the psqt half of one perspective from the finny table entry of
+// its king bucket, only the pieces that differ from that entry are applied
+static inline void refresh_psqt(thread_t *thread, position_t *pos,
+                                accumulator_t *accumulator, uint8_t side) {
   const uint8_t king_square = get_lsb(pos->bitboards[side == white ? K : k]);
   const uint8_t bucket = get_king_bucket(side, king_square);
   const uint8_t do_hm = (king_square & 7) >= 4;
   accumulator_t *finny_accumulator =
-      &thread->finny_tables[do_hm][bucket].accumulators;
+      &thread->tables->finny_tables[do_hm][bucket].accumulators;
   uint64_t *finny_bitboards =
-      thread->finny_tables[do_hm][bucket].bitboards[side];
+      thread->tables->finny_tables[do_hm][bucket].bitboards[side];
 
   psqt_list_t added_list = { .count = 0 };
   psqt_list_t removed_list = { .count = 0 };
@@ -420,8 +513,6 @@ static inline void refresh_accumulator(thread_t *thread, position_t *pos,
   }
 
   memcpy(finny_bitboards, pos->bitboards, 12 * sizeof(uint64_t));
-
-  rebuild_threats(pos, pos->mailbox, accumulator);
 }
 
 void init_accumulator(position_t *pos, accumulator_t *accumulator) {
@@ -457,8 +548,8 @@ void init_accumulator(position_t *pos, accumulator_t *accumulator) {
   rebuild_threats(pos, pos->mailbox, accumulator);
 }
 
-void init_accumulator_bucket(position_t *pos, accumulator_t *accumulator,
-                             uint8_t bucket, uint8_t do_hm) {
+static void init_accumulator_bucket(position_t *pos, accumulator_t *accumulator,
+                                    uint8_t bucket, uint8_t do_hm) {
   for (int i = 0; i < L1_SIZE; ++i) {
     accumulator->psqt_accumulator[0][i] = nnue->feature_bias[i];
     accumulator->psqt_accumulator[1][i] = nnue->feature_bias[i];
@@ -482,21 +573,26 @@ void init_accumulator_bucket(position_t *pos, accumulator_t *accumulator,
       pop_bit(bitboard, square);
     }
   }
-  rebuild_threats(pos, pos->mailbox, accumulator);
 }
 
 void init_finny_tables(thread_t *thread, position_t *pos) {
   for (uint8_t do_hm = 0; do_hm < 2; ++do_hm) {
     for (uint8_t bucket = 0; bucket < KING_BUCKETS; ++bucket) {
       init_accumulator_bucket(pos,
-                              &thread->finny_tables[do_hm][bucket].accumulators,
+                              &thread->tables->finny_tables[do_hm][bucket].accumulators,
                               bucket, do_hm);
-      memcpy(thread->finny_tables[do_hm][bucket].bitboards[white],
+      memcpy(thread->tables->finny_tables[do_hm][bucket].bitboards[white],
              pos->bitboards, 12 * sizeof(uint64_t));
-      memcpy(thread->finny_tables[do_hm][bucket].bitboards[black],
+      memcpy(thread->tables->finny_tables[do_hm][bucket].bitboards[black],
              pos->bitboards, 12 * sizeof(uint64_t));
     }
   }
+  // the threat entries start out empty, the first refresh of each one sums
+  // every feature of its position
+  for (uint8_t do_hm = 0; do_hm < 2; ++do_hm) {
+    thread->tables->threat_finny_tables[do_hm][white].count = 0;
+    thread->tables->threat_finny_tables[do_hm][black].count = 0;
+  }
 }
 
 int nnue_eval_pos(position_t *pos, accumulator_t *accumulator) {
@@ -605,11 +701,10 @@ int nnue_eval_pos(position_t *pos, accumulator_t *accumulator) {
   return (int16_t)(result * EVAL_SCALE);
 }
 
-int nnue_evaluate(thread_t *thread, position_t *pos,
-                  accumulator_t *accumulator) {
-  apply_accumulator(thread, thread->ply);
-  const uint8_t out_bucket = calculate_output_bucket(pos);
-
+// Runs L1 on the accumulator, leaving the raw sums of the L2 neurons in
+// thread->neurons, which is the scratch space of every layer
+static void nnue_l1(thread_t *thread, position_t *pos,
+                    const accumulator_t *accumulator, uint8_t out_bucket) {
   const int16_t *stmPsqt = accumulator->psqt_accumulator[pos->side];
   const int16_t *oppPsqt = accumulator->psqt_accumulator[1 - pos->side];
   const int16_t *stmThrt = accumulator->threat_accumulator[pos->side];
@@ -617,11 +712,7 @@ int nnue_evaluate(thread_t *thread, position_t *pos,
 
   simd_t *layers = &thread->neurons;
 
-  const float L1_NORMALISATION =
-      (float)(1 << INPUT_SHIFT) / (float)(INPUT_QUANT * INPUT_QUANT * L1_QUANT);
-
 #if defined(USE_SIMD)
-  const int FLOAT_VEC_SIZE = sizeof(vecf_t) / sizeof(float);
   const int I16_VEC_SIZE = sizeof(veci_t) / sizeof(int16_t);
   const int I32_STRIDE = sizeof(veci32_t) / sizeof(int32_t);
 
@@ -803,6 +894,46 @@ int nnue_evaluate(thread_t *thread, position_t *pos,
   for (int r = 0; r < L2_VECS; r++)
     *((veci32_t *)&layers->l2_neurons[r * I32_STRIDE]) = regs[r];
 
+#else
+
+  memset(layers->l2_neurons, 0, sizeof(layers->l2_neurons));
+
+  for (int l1 = 0; l1 < L1_SIZE / 2; l1++) {
+    int32_t stm_val1 = (int32_t)stmPsqt[l1] + stmThrt[l1];
+    int32_t stm_val2 =
+        (int32_t)stmPsqt[l1 + L1_SIZE / 2] + stmThrt[l1 + L1_SIZE / 2];
+
+    const int16_t stmClipped1 = clamp(stm_val1, 0, INPUT_QUANT);
+    const int16_t stmClipped2 = clamp(stm_val2, 0, INPUT_QUANT);
+    layers->l1_neurons[l1] = (stmClipped1 * stmClipped2) >> INPUT_SHIFT;
+
+    int32_t opp_val1 = (int32_t)oppPsqt[l1] + oppThrt[l1];
+    int32_t opp_val2 =
+        (int32_t)oppPsqt[l1 + L1_SIZE / 2] + oppThrt[l1 + L1_SIZE / 2];
+
+    const int16_t oppClipped1 = clamp(opp_val1, 0, INPUT_QUANT);
+    const int16_t oppClipped2 = clamp(opp_val2, 0, INPUT_QUANT);
+    layers->l1_neurons[l1 + L1_SIZE / 2] =
+        (oppClipped1 * oppClipped2) >> INPUT_SHIFT;
+  }
+
+  for (int l1 = 0; l1 < L1_SIZE; l1++) {
+    for (int l2 = 0; l2 < L2_SIZE; l2++) {
+      layers->l2_neurons[l2] += layers->l1_neurons[l1] *
+                                nnue->l1_weights[out_bucket][l1 * L2_SIZE + l2];
+    }
+  }
+#endif
+}
+
+// The float layers after L1
+static float nnue_float_tail(simd_t *layers, uint8_t out_bucket) {
+  const float L1_NORMALISATION =
+      (float)(1 << INPUT_SHIFT) / (float)(INPUT_QUANT * INPUT_QUANT * L1_QUANT);
+
+#if defined(USE_SIMD)
+  const int FLOAT_VEC_SIZE = sizeof(vecf_t) / sizeof(float);
+
   float result;
   memcpy(layers->l3_neurons, nnue->l2_bias[out_bucket],
          sizeof(layers->l3_neurons));
@@ -856,34 +987,6 @@ int nnue_evaluate(thread_t *thread, position_t *pos,
 
 #else
 
-  memset(layers->l2_neurons, 0, sizeof(layers->l2_neurons));
-
-  for (int l1 = 0; l1 < L1_SIZE / 2; l1++) {
-    int32_t stm_val1 = (int32_t)stmPsqt[l1] + stmThrt[l1];
-    int32_t stm_val2 =
-        (int32_t)stmPsqt[l1 + L1_SIZE / 2] + stmThrt[l1 + L1_SIZE / 2];
-
-    const int16_t stmClipped1 = clamp(stm_val1, 0, INPUT_QUANT);
-    const int16_t stmClipped2 = clamp(stm_val2, 0, INPUT_QUANT);
-    layers->l1_neurons[l1] = (stmClipped1 * stmClipped2) >> INPUT_SHIFT;
-
-    int32_t opp_val1 = (int32_t)oppPsqt[l1] + oppThrt[l1];
-    int32_t opp_val2 =
-        (int32_t)oppPsqt[l1 + L1_SIZE / 2] + oppThrt[l1 + L1_SIZE / 2];
-
-    const int16_t oppClipped1 = clamp(opp_val1, 0, INPUT_QUANT);
-    const int16_t oppClipped2 = clamp(opp_val2, 0, INPUT_QUANT);
-    layers->l1_neurons[l1 + L1_SIZE / 2] =
-        (oppClipped1 * oppClipped2) >> INPUT_SHIFT;
-  }
-
-  for (int l1 = 0; l1 < L1_SIZE; l1++) {
-    for (int l2 = 0; l2 < L2_SIZE; l2++) {
-      layers->l2_neurons[l2] += layers->l1_neurons[l1] *
-                                nnue->l1_weights[out_bucket][l1 * L2_SIZE + l2];
-    }
-  }
-
   memcpy(layers->l3_neurons, nnue->l2_bias[out_bucket],
          sizeof(layers->l3_neurons));
 
@@ -909,10 +1012,172 @@ int nnue_evaluate(thread_t *thread, position_t *pos,
     result += l3Activated * nnue->l3_weights[out_bucket][l3];
   }
 
+#endif
+  return result;
+}
+
+// The integer layers after L1. The L2 outputs become u8 activations, x
+// clipped to [0, 1] as about x * 127 and its clipped square as about
+// x * x * 126, and L3 runs on them with dpbusd like L1 does. The squared L3
+// outputs meet the int16 output weights in int32, only the final sum is
+// scaled back to a float. Tools/process_net folds the activation scales into
+// the weights.
+static float nnue_int_tail(simd_t *layers, uint8_t out_bucket) {
+  for (int l2 = 0; l2 < L2_SIZE; l2++) {
+    const int32_t value = clamp_int32(
+        layers->l2_neurons[l2] + nnue->l1_bias_q[out_bucket][l2], -L2_ONE,
+        L2_ONE);
+    layers->l2_activations[l2] =
+        ((value > 0 ? value : 0) + (1 << (L2_ACT_SHIFT - 1))) >> L2_ACT_SHIFT;
+    layers->l2_activations[l2 + L2_SIZE] =
+        (value * value + (1 << (L2_SQR_SHIFT - 1))) >> L2_SQR_SHIFT;
+  }
+
+#if defined(USE_SIMD)
+  const int I32_STRIDE = sizeof(veci32_t) / sizeof(int32_t);
+  const int L3_VECS = L3_SIZE / I32_STRIDE;
+  const int32_t *packs = (const int32_t *)layers->l2_activations;
+  veci32_t regs[L3_VECS];
+  for (int r = 0; r < L3_VECS; r++)
+    regs[r] = *((veci32_t *)&nnue->l2_bias_q[out_bucket][r * I32_STRIDE]);
+
+  for (int p = 0; p < 2 * L2_SIZE / INT8_PER_INT32; p += 2) {
+    const vecs8_t u0 = broadcast_pack(packs[p]);
+    const vecs8_t u1 = broadcast_pack(packs[p + 1]);
+    const int o0 = p * INT8_PER_INT32 * L3_SIZE;
+    const int o1 = (p + 1) * INT8_PER_INT32 * L3_SIZE;
+    for (int r = 0; r < L3_VECS; r++) {
+      const vecs8_t w0 =
+          *((vecs8_t *)&nnue->l2_weights_q[out_bucket]
+                                          [o0 + INT8_PER_INT32 * r * I32_STRIDE]);
+      const vecs8_t w1 =
+          *((vecs8_t *)&nnue->l2_weights_q[out_bucket]
+                                          [o1 + INT8_PER_INT32 * r * I32_STRIDE]);
+      regs[r] = dpbusd_epi32x2(regs[r], u0, w0, u1, w1);
+    }
+  }
+  for (int r = 0; r < L3_VECS; r++)
+    *((veci32_t *)&layers->l3_ints[r * I32_STRIDE]) = regs[r];
+#else
+  memcpy(layers->l3_ints, nnue->l2_bias_q[out_bucket],
+         sizeof(layers->l3_ints));
+  for (int l2 = 0; l2 < 2 * L2_SIZE; l2++) {
+    for (int l3 = 0; l3 < L3_SIZE; l3++) {
+      layers->l3_ints[l3] +=
+          layers->l2_activations[l2] *
+          nnue->l2_weights_q[out_bucket]
+                            [(l2 / INT8_PER_INT32) * INT8_PER_INT32 * L3_SIZE +
+                             l3 * INT8_PER_INT32 + (l2 % INT8_PER_INT32)];
+    }
+  }
+#endif
+
+  // small enough for the compiler to vectorise on its own
+  int32_t sum = 0;
+  for (int l3 = 0; l3 < L3_SIZE; l3++) {
+    const int32_t value = clamp_int32(layers->l3_ints[l3], 0, L3_ONE);
+    sum += ((value * value + (1 << (L3_SQR_SHIFT - 1))) >> L3_SQR_SHIFT) *
+           nnue->l3_weights_q[out_bucket][l3];
+  }
+
+  const float L3_NORMALISATION = (float)(1 << L3_SQR_SHIFT) /
+                                 ((float)L3_ONE * L3_ONE * L3_QUANT);
+  return nnue->l3_bias[out_bucket] + (float)sum * L3_NORMALISATION;
+}
+
+// Runs the layers after the accumulator. Builds with NNUE_INT_TAIL use the
+// integer tail, everything else the float one.
+static int nnue_output(thread_t *thread, position_t *pos,
+                       const accumulator_t *accumulator) {
+  const uint8_t out_bucket = calculate_output_bucket(pos);
+  nnue_l1(thread, pos, accumulator, out_bucket);
+#ifdef NNUE_INT_TAIL
+  const float result = nnue_int_tail(&thread->neurons, out_bucket);
+#else
+  const float result = nnue_float_tail(&thread->neurons, out_bucket);
 #endif
   return (int16_t)(result * EVAL_SCALE);
 }
 
+int nnue_evaluate(thread_t *thread, position_t *pos,
+                  accumulator_t *accumulator) {
+  apply_accumulator(thread, thread->ply);
+  return nnue_output(thread, pos, accumulator);
+}
+
+// Builds both halves of an accumulator for an unrelated position from the
+// finny tables
+static void refresh_position(thread_t *thread, position_t *pos,
+                             accumulator_t *accumulator) {
+  refresh_psqt(thread, pos, accumulator, white);
+  refresh_psqt(thread, pos, accumulator, black);
+  threat_list_t features;
+  collect_threats(pos, pos->mailbox, &features);
+  refresh_threats(thread, pos, &features, accumulator, white);
+  refresh_threats(thread, pos, &features, accumulator, black);
+}
+
+// Evaluates a batch of unrelated positions, such as a list of FENs. Every
+// accumulator is built from the thread's finny tables, so positions that keep
+// a king bucket only pay for the pieces that changed since the last position
+// in that bucket. Positions are visited grouped by output bucket, so the
+// weights of a bucket are loaded once per group instead of once per position.
+// Scores are stored in input order. The finny tables must have been set up
+// with init_finny_tables before the first batch.
+void nnue_evaluate_batch(thread_t *thread, position_t *positions, int count,
+                         int16_t *scores) {
+  accumulator_t *accumulator = &thread->tables->accumulator[0];
+  uint16_t order[NNUE_BATCH_SIZE];
+  int bucket_start[OUTPUT_BUCKETS + 1] = {0};
+
+  if (count > NNUE_BATCH_SIZE) {
+    count = NNUE_BATCH_SIZE;
+  }
+
+  // stable counting sort by output bucket, so positions that follow each
+  // other in a game stay next to each other and keep sharing finny entries
+  for (int i = 0; i < count; ++i) {
+    bucket_start[calculate_output_bucket(&positions[i]) + 1]++;
+  }
+  for (int bucket = 0; bucket < OUTPUT_BUCKETS; ++bucket) {
+    bucket_start[bucket + 1] += bucket_start[bucket];
+  }
+  for (int i = 0; i < count; ++i) {
+    order[bucket_start[calculate_output_bucket(&positions[i])]++] = i;
+  }
+
+  for (int i = 0; i < count; ++i) {
+    position_t *pos = &positions[order[i]];
+    refresh_position(thread, pos, accumulator);
+    scores[order[i]] = nnue_output(thread, pos, accumulator);
+  }
+}
+
+// Copies the L1 activations of a position to out, to measure how often each
+// neuron is zero. The finny tables must have been set up like for
+// nnue_evaluate_batch.
+void nnue_l1_activations(thread_t *thread, position_t *pos, uint8_t *out) {
+  accumulator_t *accumulator = &thread->tables->accumulator[0];
+  refresh_position(thread, pos, accumulator);
+  nnue_l1(thread, pos, accumulator, calculate_output_bucket(pos));
+  memcpy(out, thread->neurons.l1_neurons, L1_SIZE);
+}
+
+// Evaluates a position with both the float and the integer layers after L1,
+// to measure how far the integer tail is off. The finny tables must have been
+// set up like for nnue_evaluate_batch.
+void nnue_evaluate_tails(thread_t *thread, position_t *pos,
+                         int16_t *float_score, int16_t *int_score) {
+  accumulator_t *accumulator = &thread->tables->accumulator[0];
+  const uint8_t out_bucket = calculate_output_bucket(pos);
+  refresh_position(thread, pos, accumulator);
+  nnue_l1(thread, pos, accumulator, out_bucket);
+  *float_score =
+      (int16_t)(nnue_float_tail(&thread->neurons, out_bucket) * EVAL_SCALE);
+  *int_score =
+      (int16_t)(nnue_int_tail(&thread->neurons, out_bucket) * EVAL_SCALE);
+}
+
 static inline void
 accumulator_addsub(accumulator_t *restrict accumulator,
                    const accumulator_t *restrict prev_accumulator,
@@ -1151,19 +1416,20 @@ static void apply_threat_batches(accumulator_t *acc, const accumulator_t* acc_be
       memcpy(w_vecs, w_acc_before + i, sizeof(w_vecs));
 
       for (int j = 0; j < adds->w_count; ++j) {
-        const vec_s8* m = (const vec_s8 *)&nnue->feature_threats[adds->w_idx[j]][i];
+        vec_s16 w[CHUNK_SIZE];
+        load_threats(adds->w_idx[j], i, w);
 #pragma GCC unroll 16
         for (int k = 0; k < CHUNK_SIZE; ++k) {
-          vec_s8 w8 = *m++;
-          w_vecs[k] += __builtin_convertvector(w8, vec_s16);
+          w_vecs[k] += w[k];
         }
       }
 
       for (int j = 0; j < subs->w_count; ++j) {
-        const vec_s8* m = (const vec_s8 *)&nnue->feature_threats[subs->w_idx[j]][i];
+        vec_s16 w[CHUNK_SIZE];
+        load_threats(subs->w_idx[j], i, w);
+#pragma GCC unroll 16
         for (int k = 0; k < CHUNK_SIZE; ++k) {
-          vec_s8 w8 = *m++;
-          w_vecs[k] -= __builtin_convertvector(w8, vec_s16);
+          w_vecs[k] -= w[k];
         }
       }
 
@@ -1174,20 +1440,20 @@ static void apply_threat_batches(accumulator_t *acc, const accumulator_t* acc_be
       vec_s16 b_vecs[CHUNK_SIZE];
       memcpy(b_vecs, b_acc_before + i, sizeof(b_vecs));
       for (int j = 0; j < adds->b_count; ++j) {
-        const vec_s8* m = (const vec_s8 *)&nnue->feature_threats[adds->b_idx[j]][i];
+        vec_s16 w[CHUNK_SIZE];
+        load_threats(adds->b_idx[j], i, w);
 #pragma GCC unroll 16
         for (int k = 0; k < CHUNK_SIZE; ++k) {
-          vec_s8 w8 = *m++;
-          b_vecs[k] += __builtin_convertvector(w8, vec_s16);
+          b_vecs[k] += w[k];
         }
       }
 
       for (int j = 0; j < subs->b_count; ++j) {
-        const vec_s8* m = (const vec_s8 *)&nnue->feature_threats[subs->b_idx[j]][i];
+        vec_s16 w[CHUNK_SIZE];
+        load_threats(subs->b_idx[j], i, w);
 #pragma GCC unroll 16
         for (int k = 0; k < CHUNK_SIZE; ++k) {
-          vec_s8 w8 = *m++;
-          b_vecs[k] -= __builtin_convertvector(w8, vec_s16);
+          b_vecs[k] -= w[k];
         }
       }
 
@@ -1319,13 +1585,9 @@ static inline void update_threats_incremental(accumulator_t *acc,
   apply_threat_batches(acc, acc_before, &adds, &subs);
 }
 
-void apply_accumulator(thread_t *thread, int ply) {
-  if (ply == 0 || !thread->lazy[ply].dirty)
-    return;
-
-  apply_accumulator(thread, ply - 1);
-
-  lazy_acc_state_t *s = &thread->lazy[ply];
+// Updates the accumulator of ply from the clean one of the ply before it
+static void apply_ply(thread_t *thread, int ply) {
+  lazy_acc_state_t *s = &thread->tables->lazy[ply];
 
   if (s->psqt_needs_refresh) {
     position_t tmp;
@@ -1346,47 +1608,217 @@ void apply_accumulator(thread_t *thread, int ply) {
         tmp.mailbox[poplsb(&bb)] = i;
     }
 
-    refresh_accumulator(thread, &tmp, &thread->accumulator[ply]);
+    refresh_psqt(thread, &tmp, &thread->tables->accumulator[ply], tmp.side ^ 1);
 
     uint8_t opp = s->color_flag;
-    memcpy(thread->accumulator[ply].psqt_accumulator[opp],
-           thread->accumulator[ply - 1].psqt_accumulator[opp],
+    memcpy(thread->tables->accumulator[ply].psqt_accumulator[opp],
+           thread->tables->accumulator[ply - 1].psqt_accumulator[opp],
            L1_SIZE * sizeof(int16_t));
 
     accumulator_make_move(
-        &thread->accumulator[ply], &thread->accumulator[ply - 1],
+        &thread->tables->accumulator[ply], &thread->tables->accumulator[ply - 1],
         s->white_king_sq, s->black_king_sq, s->white_bucket, s->black_bucket,
         s->side, s->move, s->moving_piece, s->captured_piece, s->color_flag);
   } else {
     accumulator_make_move(
-        &thread->accumulator[ply], &thread->accumulator[ply - 1],
+        &thread->tables->accumulator[ply], &thread->tables->accumulator[ply - 1],
         s->white_king_sq, s->black_king_sq, s->white_bucket, s->black_bucket,
         s->side, s->move, s->moving_piece, s->captured_piece, both);
   }
 
+  update_threats_incremental(&thread->tables->accumulator[ply],
+                             &thread->tables->accumulator[ply - 1],
+                             &thread->positions[ply - 1],
+                             &thread->positions[ply]);
+
+  // the king that moved changed the mirror of its own perspective, whose
+  // incremental update above is meaningless. That half is refreshed from the
+  // threat finny entry of the new mirror, the other one stays incremental.
   if (s->threat_needs_refresh) {
-    rebuild_threats(&thread->positions[ply], thread->positions[ply].mailbox,
-                    &thread->accumulator[ply]);
+    threat_list_t features;
+    collect_threats(&thread->positions[ply], thread->positions[ply].mailbox,
+                    &features);
+    refresh_threats(thread, &thread->positions[ply], &features,
+                    &thread->tables->accumulator[ply], s->moving_piece >= 6);
+  }
+
+  s->dirty = 0;
+}
+
+// most plies folded into one pass of apply_plies, bounds the feature lists
+#define MAX_FUSED_PLIES 16
+
+typedef struct fused_list_s {
+  int add_count;
+  int sub_count;
+  unsigned adds[2 * MAX_FUSED_PLIES];
+  unsigned subs[2 * MAX_FUSED_PLIES];
+} fused_list_t;
+
+// Adds a feature, a feature removed by an earlier ply cancels out instead
+static inline void fused_add(fused_list_t *list, unsigned index) {
+  for (int i = 0; i < list->sub_count; ++i) {
+    if (list->subs[i] == index) {
+      list->subs[i] = list->subs[--list->sub_count];
+      return;
+    }
+  }
+  list->adds[list->add_count++] = index;
+}
+
+static inline void fused_sub(fused_list_t *list, unsigned index) {
+  for (int i = 0; i < list->add_count; ++i) {
+    if (list->adds[i] == index) {
+      list->adds[i] = list->adds[--list->add_count];
+      return;
+    }
+  }
+  list->subs[list->sub_count++] = index;
+}
+
+// Collects the psqt features one ply adds and removes for a perspective, the
+// same ones accumulator_make_move applies
+static void collect_move_features(const lazy_acc_state_t *s, uint8_t side,
+                                  fused_list_t *list) {
+  const uint8_t king_square =
+      side == white ? s->white_king_sq : s->black_king_sq;
+  const uint8_t from = get_move_source(s->move);
+  const uint8_t to = get_move_target(s->move);
+  const uint8_t promoted_piece = get_move_promoted(!s->side, s->move);
+  const uint8_t capture = get_move_capture(s->move);
+  const uint8_t moving_piece = s->moving_piece;
+  const uint8_t captured_piece = s->captured_piece;
+
+  if (promoted_piece) {
+    const uint8_t pawn = s->side == 0 ? p : P;
+    fused_sub(list, get_idx(side, pawn, from, king_square, 0, 0));
+    if (capture) {
+      fused_sub(list, get_idx(side, captured_piece, to, king_square, 0, 0));
+    }
+    fused_add(list, get_idx(side, promoted_piece, to, king_square, 0, 0));
+  } else if (get_move_enpassant(s->move)) {
+    const uint8_t remove_square = to + ((s->side == white) ? -8 : 8);
+    fused_sub(list,
+              get_idx(side, captured_piece, remove_square, king_square, 0, 0));
+    fused_sub(list, get_idx(side, moving_piece, from, king_square, 0, 0));
+    fused_add(list, get_idx(side, moving_piece, to, king_square, 0, 0));
+  } else if (capture) {
+    fused_sub(list, get_idx(side, captured_piece, to, king_square, 0, 0));
+    fused_sub(list, get_idx(side, moving_piece, from, king_square, 0, 0));
+    fused_add(list, get_idx(side, moving_piece, to, king_square, 0, 0));
+  } else if (get_move_castling(s->move)) {
+    const uint8_t mover = moving_piece >= 6;
+    const uint8_t cs = castle_side(get_move_castling(s->move));
+    const uint8_t rook_piece = mover == white ? R : r;
+    fused_sub(list, get_idx(side, rook_piece, to, king_square, 0, 0));
+    fused_sub(list, get_idx(side, moving_piece, from, king_square, 0, 0));
+    fused_add(list, get_idx(side, rook_piece, castle_rook_dest(mover, cs),
+                            king_square, 0, 0));
+    fused_add(list, get_idx(side, moving_piece, castle_king_dest(mover, cs),
+                            king_square, 0, 0));
   } else {
+    fused_sub(list, get_idx(side, moving_piece, from, king_square, 0, 0));
+    fused_add(list, get_idx(side, moving_piece, to, king_square, 0, 0));
+  }
+}
+
+// Brings the accumulator of ply up to date from the clean one of base in a
+// single pass, without writing the plies in between. None of those plies may
+// need a refresh, so every ply uses the same king buckets and mirrors. The
+// psqt features of all moves are folded into one list per perspective, and
+// the threats are updated from the difference between the two positions.
+static void apply_plies(thread_t *thread, int base, int ply) {
+  accumulator_t *accumulator = &thread->tables->accumulator[ply];
+  const accumulator_t *base_accumulator = &thread->tables->accumulator[base];
+  const lazy_acc_state_t *last = &thread->tables->lazy[ply];
+
+  for (uint8_t side = white; side <= black; ++side) {
+    const uint8_t bucket =
+        side == white ? last->white_bucket : last->black_bucket;
+    fused_list_t list = {.add_count = 0, .sub_count = 0};
+    for (int i = base + 1; i <= ply; ++i) {
+      collect_move_features(&thread->tables->lazy[i], side, &list);
+    }
 
-    update_threats_incremental(&thread->accumulator[ply],
-                          &thread->accumulator[ply - 1],
-                               &thread->positions[ply - 1],
-                               &thread->positions[ply]);
+    for (int i = 0; i < L1_SIZE; i += CHUNK_SIZE * CHUNK_ELTS) {
+      vec_s16 vecs[CHUNK_SIZE];
+      memcpy(vecs, &base_accumulator->psqt_accumulator[side][i], sizeof(vecs));
+
+      for (int j = 0; j < list.add_count; ++j) {
+        const vec_s16 *m =
+            (const vec_s16 *)&nnue->feature_weights[bucket][list.adds[j]][i];
+#pragma GCC unroll 16
+        for (int k = 0; k < CHUNK_SIZE; ++k) {
+          vecs[k] += *m++;
+        }
+      }
+
+      for (int j = 0; j < list.sub_count; ++j) {
+        const vec_s16 *m =
+            (const vec_s16 *)&nnue->feature_weights[bucket][list.subs[j]][i];
+#pragma GCC unroll 16
+        for (int k = 0; k < CHUNK_SIZE; ++k) {
+          vecs[k] -= *m++;
+        }
+      }
+
+      memcpy(&accumulator->psqt_accumulator[side][i], vecs, sizeof(vecs));
+    }
   }
 
-  s->dirty = 0;
+  update_threats_incremental(accumulator, (accumulator_t *)base_accumulator,
+                             &thread->positions[base],
+                             &thread->positions[ply]);
+
+  thread->tables->lazy[ply].dirty = 0;
+}
+
+// Catches the accumulator of ply up with the last clean one below it. Runs of
+// plies without refreshes are folded into one pass up to the parent of ply,
+// which is kept since its other children are likely evaluated next, and ply
+// itself is then a single update. The plies inside a run stay dirty and are
+// only written if something evaluates them later.
+void apply_accumulator(thread_t *thread, int ply) {
+  lazy_acc_state_t *lazy = thread->tables->lazy;
+  if (ply == 0 || !lazy[ply].dirty)
+    return;
+
+  int base = ply - 1;
+  while (base > 0 && lazy[base].dirty)
+    base--;
+
+  for (int i = base + 1; i < ply; ++i) {
+    if (lazy[i].psqt_needs_refresh) {
+      if (base < i - 1) {
+        apply_plies(thread, base, i - 1);
+      }
+      apply_ply(thread, i);
+      base = i;
+    } else if (i - base == MAX_FUSED_PLIES) {
+      apply_plies(thread, base, i);
+      base = i;
+    }
+  }
+
+  if (base < ply - 1) {
+    if (base == ply - 2) {
+      apply_ply(thread, ply - 1);
+    } else {
+      apply_plies(thread, base, ply - 1);
+    }
+  }
+  apply_ply(thread, ply);
 }
 
 void null_move_copy_accumulator(thread_t *thread, int src_ply, int dst_ply) {
   apply_accumulator(thread, src_ply);
-  thread->accumulator[dst_ply] = thread->accumulator[src_ply];
-  thread->lazy[dst_ply].dirty = 0;
+  thread->tables->accumulator[dst_ply] = thread->tables->accumulator[src_ply];
+  thread->tables->lazy[dst_ply].dirty = 0;
 }
 
 void update_nnue(position_t *pos, thread_t *thread, uint8_t mailbox_copy[64],
                  uint16_t move) {
-  lazy_acc_state_t *state = &thread->lazy[thread->ply];
+  lazy_acc_state_t *state = &thread->tables->lazy[thread->ply];
   const uint8_t from = get_move_source(move);
   const uint8_t to = get_move_target(move);
 
@@ -1433,3 +1865,194 @@ void update_nnue(position_t *pos, thread_t *thread, uint8_t mailbox_copy[64],
     memcpy(state->bitboards, pos->bitboards, 12 * sizeof(uint64_t));
   }
 }
+
+typedef struct bench_clock_s {
+  uint64_t ns;
+  uint64_t cycles;
+} bench_clock_t;
+
+static inline bench_clock_t bench_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  bench_clock_t now = {(uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec, 0};
+#if defined(__x86_64__) || defined(__i386__)
+  now.cycles = __rdtsc();
+#endif
+  return now;
+}
+
+static inline void bench_add(nnue_bench_result_t *result, bench_clock_t start,
+                             uint64_t ops) {
+  const bench_clock_t end = bench_now();
+  result->ops += ops;
+  result->ns += end.ns - start.ns;
+  result->cycles += end.cycles - start.cycles;
+}
+
+// Takes the clock reads off a result, kernels faster than the noise of the
+// measured overhead end up at 0 rather than wrapping around
+static void bench_remove_overhead(nnue_bench_result_t *result,
+                                  bench_clock_t overhead) {
+  const uint64_t ns = result->ops * overhead.ns;
+  const uint64_t cycles = result->ops * overhead.cycles;
+  result->ns = result->ns > ns ? result->ns - ns : 0;
+  result->cycles = result->cycles > cycles ? result->cycles - cycles : 0;
+}
+
+// Times the kernels of the accumulator and the network on the positions of
+// recorded make/unmake sequences. The sequences are replayed the way search
+// plays them, catching the accumulator up after every move, which also
+// collects the positions before and after each move. Every other kernel then
+// runs over those in a loop of its own. Kernels that are too short for the
+// clock on their own, like L1 and the tails, are timed per call, with the
+// cost of reading the clock subtracted. Returns the number of results.
+int nnue_bench(thread_t *thread, const nnue_trace_t *traces, int count,
+               nnue_bench_result_t *results) {
+  enum {
+    APPLY,
+    MAKE_MOVE,
+    THREATS,
+    CHANGED_SQUARES,
+    REFRESH,
+    L1,
+    FLOAT_TAIL,
+    INT_TAIL
+  };
+  static const char *names[NNUE_BENCH_KERNELS] = {
+      "apply_accumulator",       "accumulator_make_move",
+      "update_threats_incremental", "process_changed_squares",
+      "refresh (finny tables)",  "l1 (sparse)",
+      "float tail",              "int tail"};
+  memset(results, 0, NNUE_BENCH_KERNELS * sizeof(nnue_bench_result_t));
+  for (int i = 0; i < NNUE_BENCH_KERNELS; ++i) {
+    results[i].kernel = names[i];
+  }
+
+  int moves = 0;
+  for (int i = 0; i < count; ++i) {
+    for (int j = 0; j < traces[i].length; ++j) {
+      moves += traces[i].moves[j] != 0;
+    }
+  }
+  position_t *before = malloc(moves * sizeof(position_t));
+  position_t *after = malloc(moves * sizeof(position_t));
+  lazy_acc_state_t *states = malloc(moves * sizeof(lazy_acc_state_t));
+  if (!before || !after || !states) {
+    free(before);
+    free(after);
+    free(states);
+    return 0;
+  }
+
+  // cost of one clock read, taken off the kernels timed per call
+  bench_clock_t overhead = bench_now();
+  for (int i = 0; i < 1000; ++i) {
+    bench_now();
+  }
+  const bench_clock_t overhead_end = bench_now();
+  overhead = (bench_clock_t){(overhead_end.ns - overhead.ns) / 1001,
+                             (overhead_end.cycles - overhead.cycles) / 1001};
+
+  accumulator_t *accumulators = thread->tables->accumulator;
+  int collected = 0;
+  for (int i = 0; i < count; ++i) {
+    const nnue_trace_t *trace = &traces[i];
+    thread->ply = 0;
+    thread->positions[0] = trace->root;
+    init_accumulator(&thread->positions[0], &accumulators[0]);
+    init_finny_tables(thread, &thread->positions[0]);
+
+    for (int j = 0; j < trace->length; ++j) {
+      const uint16_t move = trace->moves[j];
+      if (!move) {
+        thread->ply--;
+        continue;
+      }
+      position_t *pos = &thread->positions[thread->ply];
+      thread->positions[++thread->ply] = *pos;
+      make_move(&thread->positions[thread->ply], move);
+      update_nnue(&thread->positions[thread->ply], thread, pos->mailbox, move);
+
+      before[collected] = *pos;
+      after[collected] = thread->positions[thread->ply];
+      states[collected++] = thread->tables->lazy[thread->ply];
+
+      bench_clock_t start = bench_now();
+      apply_accumulator(thread, thread->ply);
+      bench_add(&results[APPLY], start, 1);
+    }
+  }
+
+  bench_clock_t start = bench_now();
+  for (int i = 0; i < moves; ++i) {
+    const lazy_acc_state_t *s = &states[i];
+    if (!s->psqt_needs_refresh) {
+      accumulator_make_move(&accumulators[1], &accumulators[0],
+                            s->white_king_sq, s->black_king_sq,
+                            s->white_bucket, s->black_bucket, s->side, s->move,
+                            s->moving_piece, s->captured_piece, both);
+      results[MAKE_MOVE].ops++;
+    }
+  }
+  bench_add(&results[MAKE_MOVE], start, 0);
+
+  start = bench_now();
+  for (int i = 0; i < moves; ++i) {
+    update_threats_incremental(&accumulators[1], &accumulators[0], &before[i],
+                               &after[i]);
+  }
+  bench_add(&results[THREATS], start, moves);
+
+  volatile int sink = 0;
+  start = bench_now();
+  for (int i = 0; i < moves; ++i) {
+    uint64_t changed = 0;
+    for (int piece = 0; piece < 12; ++piece) {
+      changed |= before[i].bitboards[piece] ^ after[i].bitboards[piece];
+    }
+    threat_list_t adds = {.w_count = 0, .b_count = 0};
+    threat_list_t subs = {.w_count = 0, .b_count = 0};
+    process_changed_squares(&before[i], changed, &subs);
+    process_changed_squares(&after[i], changed, &adds);
+    sink += adds.w_count + subs.b_count;
+  }
+  bench_add(&results[CHANGED_SQUARES], start, 2 * moves);
+
+  init_finny_tables(thread, &after[0]);
+  start = bench_now();
+  for (int i = 0; i < moves; ++i) {
+    refresh_position(thread, &after[i], &accumulators[0]);
+  }
+  bench_add(&results[REFRESH], start, moves);
+
+  for (int i = 0; i < moves; ++i) {
+    const uint8_t out_bucket = calculate_output_bucket(&after[i]);
+    refresh_position(thread, &after[i], &accumulators[0]);
+
+    start = bench_now();
+    nnue_l1(thread, &after[i], &accumulators[0], out_bucket);
+    bench_add(&results[L1], start, 1);
+
+    const simd_t neurons = thread->neurons;
+    start = bench_now();
+    sink += nnue_float_tail(&thread->neurons, out_bucket) > 0;
+    bench_add(&results[FLOAT_TAIL], start, 1);
+
+    thread->neurons = neurons;
+    start = bench_now();
+    sink += nnue_int_tail(&thread->neurons, out_bucket) > 0;
+    bench_add(&results[INT_TAIL], start, 1);
+  }
+  (void)sink;
+
+  bench_remove_overhead(&results[APPLY], overhead);
+  for (int i = L1; i <= INT_TAIL; ++i) {
+    bench_remove_overhead(&results[i], overhead);
+  }
+
+  thread->ply = 0;
+  free(before);
+  free(after);
+  free(states);
+  return NNUE_BENCH_KERNELS;
+}
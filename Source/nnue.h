@@ -5,8 +5,21 @@
 #include "arch.h"
 #include <stdint.h>
 
+// Columns of a threat row sharing one shift in the 4 bit format. Byte b of a
+// block holds column b in its low nibble and column b + THREAT_BLOCK / 2 in
+// its high one, so registers of up to THREAT_BLOCK / 2 columns are widened
+// from contiguous bytes.
+#define THREAT_BLOCK 32
+
 typedef struct nnue {
+#ifdef NNUE_THREAT_INT4
+  // 4 bit threat weights in blocks of THREAT_BLOCK columns, weight
+  // q << threat_shifts[feature][block] for a nibble q in [-8, 7]
+  _Alignas(64) uint8_t feature_threats[THREAT_FEATURES][L1_SIZE / 2];
+  _Alignas(64) uint8_t threat_shifts[THREAT_FEATURES][L1_SIZE / THREAT_BLOCK];
+#else
   _Alignas(64) int8_t  feature_threats[THREAT_FEATURES][L1_SIZE];
+#endif
   _Alignas(64) int16_t feature_weights[KING_BUCKETS][PSQT_FEATURES][L1_SIZE];
   _Alignas(64) int16_t feature_bias[L1_SIZE];
   _Alignas(64) int8_t  l1_weights[OUTPUT_BUCKETS][L1_SIZE * L2_SIZE];
@@ -15,17 +28,88 @@ typedef struct nnue {
   _Alignas(64) float   l2_bias[OUTPUT_BUCKETS][L3_SIZE];
   _Alignas(64) float   l3_weights[OUTPUT_BUCKETS][L3_SIZE];
   _Alignas(64) float   l3_bias[OUTPUT_BUCKETS];
+  // fixed point copies of the layers after L1 for the integer tail
+  _Alignas(64) int32_t l1_bias_q[OUTPUT_BUCKETS][L2_SIZE];
+  _Alignas(64) int8_t  l2_weights_q[OUTPUT_BUCKETS][2 * L2_SIZE * L3_SIZE];
+  _Alignas(64) int32_t l2_bias_q[OUTPUT_BUCKETS][L3_SIZE];
+  _Alignas(64) int16_t l3_weights_q[OUTPUT_BUCKETS][L3_SIZE];
 } nnue_t;
 
-extern const nnue_t *nnue;
+// Scales of the integer tail. L2 outputs are in units of L2_ONE and become
+// u8 activations of at most 127, x itself through L2_ACT_SHIFT and the
+// square of x through L2_SQR_SHIFT. L3 outputs are in units of L3_ONE and
+// are squared into u8 through L3_SQR_SHIFT.
+#define L2_ACT_SHIFT 7
+#define L2_SQR_SHIFT 21
+#define L3_SQR_SHIFT 19
+#define L2_ONE (127 << L2_ACT_SHIFT)
+#define L3_ONE (127 * L2_QUANT)
+
+// Tools/process_net appends this footer to the weights. The layout tells
+// apart the SIMD and scalar weight orders and the network sizes, EvalFile
+// only maps files matching the build.
+typedef struct nnue_footer {
+  uint64_t magic;
+  uint64_t layout;
+  uint64_t hash;
+} nnue_footer_t;
+
+#define NNUE_FILE_MAGIC 0x3054454E45555100ULL
+#ifdef USE_SIMD
+#define NNUE_FILE_LAYOUT (((uint64_t)sizeof(nnue_t) << 1) | 1)
+#else
+#define NNUE_FILE_LAYOUT ((uint64_t)sizeof(nnue_t) << 1)
+#endif
+
+// most positions nnue_evaluate_batch takes at once
+#define NNUE_BATCH_SIZE 1024
+
+// Make/unmake sequence from one root position replayed by nnue_bench, a zero
+// move takes back the last move made
+#define NNUE_TRACE_LENGTH 512
+
+typedef struct nnue_trace {
+  position_t root;
+  int length;
+  uint16_t moves[NNUE_TRACE_LENGTH];
+} nnue_trace_t;
+
+// Time spent in one kernel by nnue_bench. Cycles are counted by the time
+// stamp counter and stay zero where there is none.
+typedef struct nnue_bench_result {
+  const char *kernel;
+  uint64_t ops;
+  uint64_t ns;
+  uint64_t cycles;
+} nnue_bench_result_t;
+
+#define NNUE_BENCH_KERNELS 8
+
+extern _Thread_local const nnue_t *nnue;
+extern int EVAL_SCALE;
 
 void nnue_init(void);
+const char *nnue_kernel_name(void);
+uint64_t nnue_hash(void);
+const nnue_t *nnue_network(void);
+const char *nnue_network_name(void);
+int nnue_load_network(const char *path);
+void nnue_use_large_pages(void);
+const char *nnue_network_pages(void);
 void init_accumulator(position_t *pos, accumulator_t *accumulator);
 void init_finny_tables(thread_t *thread, position_t *pos);
 int nnue_evaluate(thread_t *thread, position_t *pos, accumulator_t *accumulator);
 int nnue_eval_pos(position_t *pos, accumulator_t *accumulator);
+void nnue_evaluate_batch(thread_t *thread, position_t *positions, int count,
+                         int16_t *scores);
+void nnue_evaluate_tails(thread_t *thread, position_t *pos,
+                         int16_t *float_score, int16_t *int_score);
+void nnue_l1_activations(thread_t *thread, position_t *pos, uint8_t *out);
 void update_nnue(position_t *pos, thread_t *thread, uint8_t mailbox_copy[64], uint16_t move);
 void apply_accumulator(thread_t *thread, int ply);
 void null_move_copy_accumulator(thread_t *thread, int src_ply, int dst_ply);
+int nnue_bench(thread_t *thread, const nnue_trace_t *traces, int count,
+               nnue_bench_result_t *results);
+uint8_t nnue_use_kernels(int index);
 
 #endif
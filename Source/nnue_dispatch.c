@@ -0,0 +1,204 @@
+#include "nnue.h"
+#include "attacks.h"
+#include "structs.h"
+#include <stdint.h>
+
+#ifdef USE_DISPATCH
+
+// Fat builds link one copy of the kernels per instruction set (see
+// dispatch.h) and forward the public entry points to the best copy the cpu
+// can run. The table is picked once in nnue_init, before any thread starts.
+typedef struct {
+  const char *name;
+  void (*nnue_init)(void);
+  void (*init_accumulator)(position_t *pos, accumulator_t *accumulator);
+  void (*init_finny_tables)(thread_t *thread, position_t *pos);
+  int (*nnue_evaluate)(thread_t *thread, position_t *pos,
+                       accumulator_t *accumulator);
+  int (*nnue_eval_pos)(position_t *pos, accumulator_t *accumulator);
+  void (*nnue_evaluate_batch)(thread_t *thread, position_t *positions,
+                              int count, int16_t *scores);
+  void (*nnue_evaluate_tails)(thread_t *thread, position_t *pos,
+                              int16_t *float_score, int16_t *int_score);
+  void (*nnue_l1_activations)(thread_t *thread, position_t *pos, uint8_t *out);
+  void (*update_nnue)(position_t *pos, thread_t *thread,
+                      uint8_t mailbox_copy[64], uint16_t move);
+  void (*apply_accumulator)(thread_t *thread, int ply);
+  void (*null_move_copy_accumulator)(thread_t *thread, int src_ply,
+                                     int dst_ply);
+  void (*calculate_threats)(position_t *pos, searchstack_t *ss);
+  int (*nnue_bench)(thread_t *thread, const nnue_trace_t *traces, int count,
+                    nnue_bench_result_t *results);
+} nnue_kernels_t;
+
+#define DECLARE_KERNELS(isa)                                                   \
+  void nnue_init_##isa(void);                                                  \
+  void init_accumulator_##isa(position_t *pos, accumulator_t *accumulator);    \
+  void init_finny_tables_##isa(thread_t *thread, position_t *pos);             \
+  int nnue_evaluate_##isa(thread_t *thread, position_t *pos,                   \
+                          accumulator_t *accumulator);                         \
+  int nnue_eval_pos_##isa(position_t *pos, accumulator_t *accumulator);        \
+  void nnue_evaluate_batch_##isa(thread_t *thread, position_t *positions,      \
+                                 int count, int16_t *scores);                  \
+  void nnue_evaluate_tails_##isa(thread_t *thread, position_t *pos,            \
+                                 int16_t *float_score, int16_t *int_score);    \
+  void nnue_l1_activations_##isa(thread_t *thread, position_t *pos,            \
+                                 uint8_t *out);                                \
+  void update_nnue_##isa(position_t *pos, thread_t *thread,                    \
+                         uint8_t mailbox_copy[64], uint16_t move);             \
+  void apply_accumulator_##isa(thread_t *thread, int ply);                     \
+  void null_move_copy_accumulator_##isa(thread_t *thread, int src_ply,         \
+                                        int dst_ply);                          \
+  void calculate_threats_##isa(position_t *pos, searchstack_t *ss);            \
+  int nnue_bench_##isa(thread_t *thread, const nnue_trace_t *traces,           \
+                       int count, nnue_bench_result_t *results);               \
+  static const nnue_kernels_t kernels_##isa = {                                \
+      #isa,                                                                    \
+      nnue_init_##isa,                                                         \
+      init_accumulator_##isa,                                                  \
+      init_finny_tables_##isa,                                                 \
+      nnue_evaluate_##isa,                                                     \
+      nnue_eval_pos_##isa,                                                     \
+      nnue_evaluate_batch_##isa,                                               \
+      nnue_evaluate_tails_##isa,                                               \
+      nnue_l1_activations_##isa,                                               \
+      update_nnue_##isa,                                                       \
+      apply_accumulator_##isa,                                                 \
+      null_move_copy_accumulator_##isa,                                        \
+      calculate_threats_##isa,                                                 \
+      nnue_bench_##isa,                                                        \
+  };
+
+DECLARE_KERNELS(avx2)
+DECLARE_KERNELS(avx512)
+DECLARE_KERNELS(avx512icl)
+
+static const nnue_kernels_t *kernels = &kernels_avx2;
+
+static const nnue_kernels_t *select_kernels(void) {
+  __builtin_cpu_init();
+  // the icelake copy is built with the full set of the x86-64-avx512icl build
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+      __builtin_cpu_supports("avx512cd") && __builtin_cpu_supports("avx512vl") &&
+      __builtin_cpu_supports("avx512dq") &&
+      __builtin_cpu_supports("avx512ifma") &&
+      __builtin_cpu_supports("avx512vbmi") &&
+      __builtin_cpu_supports("avx512vbmi2") &&
+      __builtin_cpu_supports("avx512vpopcntdq") &&
+      __builtin_cpu_supports("avx512bitalg") &&
+      __builtin_cpu_supports("avx512vnni") &&
+      __builtin_cpu_supports("vpclmulqdq") && __builtin_cpu_supports("gfni") &&
+      __builtin_cpu_supports("vaes")) {
+    return &kernels_avx512icl;
+  }
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+    return &kernels_avx512;
+  }
+  return &kernels_avx2;
+}
+
+const char *nnue_kernel_name(void) { return kernels->name; }
+
+void nnue_init(void) {
+  // cpu_check.c has made sure the cpu runs at least the avx2 copy
+  kernels = select_kernels();
+  kernels->nnue_init();
+}
+
+void init_accumulator(position_t *pos, accumulator_t *accumulator) {
+  kernels->init_accumulator(pos, accumulator);
+}
+
+void init_finny_tables(thread_t *thread, position_t *pos) {
+  kernels->init_finny_tables(thread, pos);
+}
+
+int nnue_evaluate(thread_t *thread, position_t *pos,
+                  accumulator_t *accumulator) {
+  return kernels->nnue_evaluate(thread, pos, accumulator);
+}
+
+int nnue_eval_pos(position_t *pos, accumulator_t *accumulator) {
+  return kernels->nnue_eval_pos(pos, accumulator);
+}
+
+void nnue_evaluate_batch(thread_t *thread, position_t *positions, int count,
+                         int16_t *scores) {
+  kernels->nnue_evaluate_batch(thread, positions, count, scores);
+}
+
+void nnue_evaluate_tails(thread_t *thread, position_t *pos,
+                         int16_t *float_score, int16_t *int_score) {
+  kernels->nnue_evaluate_tails(thread, pos, float_score, int_score);
+}
+
+void nnue_l1_activations(thread_t *thread, position_t *pos, uint8_t *out) {
+  kernels->nnue_l1_activations(thread, pos, out);
+}
+
+void update_nnue(position_t *pos, thread_t *thread, uint8_t mailbox_copy[64],
+                 uint16_t move) {
+  kernels->update_nnue(pos, thread, mailbox_copy, move);
+}
+
+void apply_accumulator(thread_t *thread, int ply) {
+  kernels->apply_accumulator(thread, ply);
+}
+
+void null_move_copy_accumulator(thread_t *thread, int src_ply, int dst_ply) {
+  kernels->null_move_copy_accumulator(thread, src_ply, dst_ply);
+}
+
+void calculate_threats(position_t *pos, searchstack_t *ss) {
+  kernels->calculate_threats(pos, ss);
+}
+
+int nnue_bench(thread_t *thread, const nnue_trace_t *traces, int count,
+               nnue_bench_result_t *results) {
+  return kernels->nnue_bench(thread, traces, count, results);
+}
+
+// Switches to the index-th kernel set the cpu can run, from the oldest
+// instruction set up, so benchmarks can compare them. A negative index goes
+// back to the best set. Returns 0 past the last set. Must not be called
+// while anything is evaluating.
+uint8_t nnue_use_kernels(int index) {
+  const nnue_kernels_t *best = select_kernels();
+  const nnue_kernels_t *sets[] = {&kernels_avx2, &kernels_avx512,
+                                  &kernels_avx512icl};
+  // every set needs a subset of the instructions of the next one, so the cpu
+  // runs all of them up to the best
+  int supported = 1;
+  while (sets[supported - 1] != best) {
+    supported++;
+  }
+  if (index >= supported) {
+    return 0;
+  }
+  kernels = index < 0 ? best : sets[index];
+  kernels->nnue_init();
+  return 1;
+}
+
+#else
+
+uint8_t nnue_use_kernels(int index) { return index <= 0; }
+
+// Single instruction set builds call the kernels directly
+const char *nnue_kernel_name(void) {
+#if defined(USE_AVX512ICL)
+  return "avx512icl";
+#elif defined(USE_AVX512)
+  return "avx512";
+#elif defined(USE_AVX2)
+  return "avx2";
+#elif defined(USE_NEON_DOTPROD)
+  return "neon dotprod";
+#elif defined(USE_NEON)
+  return "neon";
+#else
+  return "generic";
+#endif
+}
+
+#endif
@@ -0,0 +1,126 @@
+#ifdef __linux__
+// cpu_set_t and sched_setaffinity are GNU extensions
+#define _GNU_SOURCE
+#endif
+
+#include "numa.h"
+#include "nnue.h"
+#include "utils.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Spread search threads over the NUMA nodes and give every node its own copy
+// of the network weights. Only does something on Linux machines with more
+// than one node.
+uint8_t numa_enabled = 0;
+
+#define MAX_NUMA_NODES 64
+
+static int node_count = 0;
+
+#ifdef __linux__
+static cpu_set_t node_cpus[MAX_NUMA_NODES];
+static const nnue_t *node_nnue[MAX_NUMA_NODES];
+static pthread_mutex_t replica_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Parses a sysfs cpu list such as "0-15,32-47"
+static void parse_cpu_list(const char *list, cpu_set_t *set) {
+  CPU_ZERO(set);
+  while (*list) {
+    char *end;
+    const long first = strtol(list, &end, 10);
+    long last = first;
+    if (end == list)
+      break;
+    if (*end == '-')
+      last = strtol(end + 1, &end, 10);
+    for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu)
+      CPU_SET(cpu, set);
+    list = *end == ',' ? end + 1 : end;
+    if (*list == '\n')
+      break;
+  }
+}
+
+// Copies the weights into memory first touched by a thread running on the
+// node, so the pages are allocated there
+static const nnue_t *node_replica(int node) {
+  pthread_mutex_lock(&replica_mutex);
+  if (!node_nnue[node]) {
+    uint8_t pages;
+    void *mem = alloc_large(sizeof(nnue_t), &pages);
+    if (mem) {
+      memcpy(mem, nnue_network(), sizeof(nnue_t));
+      node_nnue[node] = (const nnue_t *)mem;
+    }
+  }
+  pthread_mutex_unlock(&replica_mutex);
+  return node_nnue[node];
+}
+#endif
+
+// Drops the replicas of the active network so the next binding copies the
+// one replacing it. Nothing may be evaluating.
+void numa_free_replicas(void) {
+#ifdef __linux__
+  for (int node = 0; node < MAX_NUMA_NODES; ++node) {
+    if (node_nnue[node]) {
+      free_large((void *)node_nnue[node], sizeof(nnue_t));
+      node_nnue[node] = NULL;
+    }
+  }
+#endif
+}
+
+void numa_init(void) {
+#ifdef __linux__
+  node_count = 0;
+  for (int node = 0; node < MAX_NUMA_NODES; ++node) {
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+             node);
+    FILE *file = fopen(path, "r");
+    if (!file)
+      break;
+
+    char list[4096] = {0};
+    if (fgets(list, sizeof(list), file))
+      parse_cpu_list(list, &node_cpus[node]);
+    fclose(file);
+
+    // memory only nodes have no cpus to run search threads on
+    if (CPU_COUNT(&node_cpus[node]) == 0)
+      break;
+    node_count++;
+  }
+#endif
+}
+
+int numa_node_count(void) { return node_count; }
+
+// Points the calling thread at the active network. With NUMA it is also
+// pinned to the node that owns search thread thread_index and reads that
+// node's replica of the network instead.
+void numa_bind_thread(int thread_index) {
+  nnue = nnue_network();
+#ifdef __linux__
+  if (!numa_enabled || node_count < 2)
+    return;
+
+  const int node = thread_index % node_count;
+  sched_setaffinity(0, sizeof(cpu_set_t), &node_cpus[node]);
+
+  const nnue_t *replica = node_replica(node);
+  if (replica)
+    nnue = replica;
+#else
+  (void)thread_index;
+#endif
+}
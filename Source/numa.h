@@ -0,0 +1,13 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <stdint.h>
+
+extern uint8_t numa_enabled;
+
+void numa_init(void);
+int numa_node_count(void);
+void numa_bind_thread(int thread_index);
+void numa_free_replicas(void);
+
+#endif
@@ -1,32 +1,64 @@
+#include "perft.h"
 #include "move.h"
 #include "movegen.h"
 #include "structs.h"
+#include "threads.h"
 #include "uci.h"
 #include "utils.h"
 #include <inttypes.h>
 #include <math.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
-static inline void perft_driver(position_t *pos, thread_t *thread, int depth) {
+// Perft splits the root moves over the search threads and remembers the
+// count of every subtree in a table shared by all of them. Entries are read
+// and written without locks, the key is stored XORed with the data so an
+// entry made of two different writes never matches.
 
-  if (depth == 1) {
-    moves move_list[1];
-    generate_noisy(pos, move_list, 0);
-    generate_quiets(pos, move_list, 1);
-    for (uint32_t i = 0; i < move_list->count; i++) {
-      if (is_legal(pos, move_list->entry[i].move)) {
-        thread->nodes++;
-      }
-    }
-    return;
+#define PERFT_HASH_ENTRIES (1ULL << 22)
+
+typedef struct {
+  atomic_uint_fast64_t check;
+  atomic_uint_fast64_t data;
+} perft_entry_t;
+
+static perft_entry_t *perft_table = NULL;
+
+// A fresh anonymous mapping is zero filled, which is an empty table
+static void alloc_perft_table(void) {
+  uint8_t pages;
+  perft_table = (perft_entry_t *)alloc_large(
+      PERFT_HASH_ENTRIES * sizeof(perft_entry_t), &pages);
+}
+
+static void free_perft_table(void) {
+  if (perft_table) {
+    free_large(perft_table, PERFT_HASH_ENTRIES * sizeof(perft_entry_t));
+    perft_table = NULL;
   }
+}
 
-  // recursion escape condition
-  if (depth == 0) {
-    // increment nodes count (count reached positions)
-    thread->nodes++;
-    return;
+// the same position at another depth goes to another slot
+static inline perft_entry_t *perft_entry(uint64_t hash, int depth) {
+  return &perft_table[(hash ^ (depth * 0x9E3779B97F4A7C15ULL)) &
+                      (PERFT_HASH_ENTRIES - 1)];
+}
+
+static uint64_t perft_driver(position_t *pos, int depth) {
+  const uint64_t hash = pos->hash_keys.hash_key;
+  perft_entry_t *entry = NULL;
+
+  if (depth > 1 && perft_table) {
+    entry = perft_entry(hash, depth);
+    const uint64_t data =
+        atomic_load_explicit(&entry->data, memory_order_relaxed);
+    const uint64_t check =
+        atomic_load_explicit(&entry->check, memory_order_relaxed);
+    if ((check ^ data) == hash && (data & 0xFF) == (uint64_t)depth) {
+      return data >> 8;
+    }
   }
 
   // create move list instance
@@ -36,64 +68,189 @@ static inline void perft_driver(position_t *pos, thread_t *thread, int depth) {
   generate_noisy(pos, move_list, 0);
   generate_quiets(pos, move_list, 1);
 
+  // the generators only emit legal moves, so the last ply is just counted
+  if (depth == 1) {
+    return move_list->count;
+  }
+
+  uint64_t nodes = 0;
+
   // loop over generated moves
   for (uint32_t move_count = 0; move_count < move_list->count; move_count++) {
-    if (!is_legal(pos, move_list->entry[move_count].move)) {
-      continue;
-    }
     position_t pos_copy = *pos;
 
     // make move
     make_move(&pos_copy, move_list->entry[move_count].move);
 
     // call perft driver recursively
-    perft_driver(&pos_copy, thread, depth - 1);
+    nodes += perft_driver(&pos_copy, depth - 1);
   }
+
+  if (entry) {
+    const uint64_t data = nodes << 8 | depth;
+    atomic_store_explicit(&entry->data, data, memory_order_relaxed);
+    atomic_store_explicit(&entry->check, hash ^ data, memory_order_relaxed);
+  }
+
+  return nodes;
 }
 
-// perft test
-void perft_test(position_t *pos, thread_t *searchinfo, int depth) {
-  printf("\n     Performance test\n\n");
+// Root moves are handed out one at a time to whichever thread is free
+typedef struct {
+  position_t *pos;
+  moves *root_moves;
+  uint64_t *counts;
+  atomic_int next;
+  int depth;
+} perft_job_t;
 
-  // create move list instance
-  moves move_list[1];
+static void *perft_worker(void *arg) {
+  perft_job_t *job = (perft_job_t *)arg;
+  int i;
+  while ((i = atomic_fetch_add_explicit(&job->next, 1,
+                                        memory_order_relaxed)) <
+         (int)job->root_moves->count) {
+    position_t pos_copy = *job->pos;
+    make_move(&pos_copy, job->root_moves->entry[i].move);
+    job->counts[i] =
+        job->depth > 1 ? perft_driver(&pos_copy, job->depth - 1) : 1;
+  }
+  return NULL;
+}
 
-  // generate moves
-  generate_noisy(pos, move_list, 0);
-  generate_quiets(pos, move_list, 1);
+// Counts the leaves below every root move with thread_count threads, the
+// calling thread being one of them. Returns the total.
+static uint64_t perft_split(position_t *pos, int depth, int thread_count,
+                            moves *root_moves, uint64_t *counts) {
+  generate_noisy(pos, root_moves, 0);
+  generate_quiets(pos, root_moves, 1);
 
-  // init start time
-  const long start = get_time_ms();
-  searchinfo->nodes = 0;
+  perft_job_t job = {
+      .pos = pos, .root_moves = root_moves, .counts = counts, .depth = depth};
+  atomic_init(&job.next, 0);
 
-  // loop over generated moves
-  for (uint32_t move_count = 0; move_count < move_list->count; move_count++) {
-    if (!is_legal(pos, move_list->entry[move_count].move)) {
-      continue;
-    }
-    position_t pos_copy = *pos;
+  // with fewer workers than asked for the pool could grow to, the moves are
+  // shared by the ones there are
+  const int wanted = MIN(thread_count, (int)root_moves->count) - 1;
+  int helpers = 0;
+  while (helpers < wanted && thread_pool_start(helpers, perft_worker, &job)) {
+    helpers++;
+  }
+  perft_worker(&job);
+  thread_pool_wait(helpers);
 
-    // make move
-    make_move(&pos_copy, move_list->entry[move_count].move);
+  uint64_t nodes = 0;
+  for (uint32_t i = 0; i < root_moves->count; ++i) {
+    nodes += counts[i];
+  }
+  return nodes;
+}
 
-    // cummulative nodes
-    const long cummulative_nodes = searchinfo->nodes;
+// perft test
+void perft_test(position_t *pos, int depth, int thread_count) {
+  printf("\n     Performance test\n\n");
 
-    // call perft driver recursively
-    perft_driver(&pos_copy, searchinfo, depth - 1);
+  depth = MAX(depth, 1);
+  moves move_list[1];
+  uint64_t counts[256];
 
-    // old nodes
-    const long old_nodes = searchinfo->nodes - cummulative_nodes;
+  // init start time
+  const long start = get_time_ms();
 
+  alloc_perft_table();
+  const uint64_t nodes =
+      perft_split(pos, depth, thread_count, move_list, counts);
+  free_perft_table();
+
+  for (uint32_t move_count = 0; move_count < move_list->count; move_count++) {
     printf("     move: ");
     print_move(move_list->entry[move_count].move);
-    printf("  nodes: %ld\n", old_nodes);
+    printf("  nodes: %" PRIu64 "\n", counts[move_count]);
   }
 
   // print results
   printf("\n    Depth: %d\n", depth);
-  uint64_t nps = (searchinfo->nodes / fmax(get_time_ms() - start, 1)) * 1000;
-  printf("    Nodes: %" PRIu64 "\n", searchinfo->nodes);
+  uint64_t nps = (nodes / fmax(get_time_ms() - start, 1)) * 1000;
+  printf("    Nodes: %" PRIu64 "\n", nodes);
   printf("     Time: %" PRIu64 "\n\n", get_time_ms() - start);
   printf("      NPS: %" PRIu64 "\n\n", nps);
 }
+
+// Checks every position of an EPD file in the usual perft suite format,
+//   <fen> ;D1 20 ;D2 400 ;D3 8902
+// against its known counts, up to max_depth. Returns the number of
+// positions with a wrong count.
+int perft_suite(position_t *pos, thread_t *thread, const char *path,
+                int max_depth, int thread_count) {
+  FILE *in = fopen(path, "r");
+  if (!in) {
+    printf("Could not open %s\n", path);
+    return 0;
+  }
+
+  alloc_perft_table();
+
+  char line[1024];
+  char command[1100];
+  moves move_list[1];
+  uint64_t counts[256];
+  int positions = 0, failed = 0;
+  uint64_t total_nodes = 0;
+  const uint64_t start = get_time_ms();
+
+  while (fgets(line, sizeof(line), in)) {
+    char *depths = strchr(line, ';');
+    if (!depths) {
+      continue;
+    }
+    *depths++ = '\0';
+    size_t length = strlen(line);
+    while (length && (line[length - 1] == ' ' || line[length - 1] == '\t')) {
+      line[--length] = '\0';
+    }
+    snprintf(command, sizeof(command), "position fen %s", line);
+    parse_position(pos, thread, command);
+    positions++;
+
+    const uint64_t position_start = get_time_ms();
+    uint8_t ok = 1;
+    int depth = 0;
+    uint64_t nodes = 0, expected = 0;
+    char *token = depths;
+    while (token) {
+      int d;
+      uint64_t count;
+      if (sscanf(token, " D%d %" SCNu64, &d, &count) == 2 && d >= 1 &&
+          d <= max_depth) {
+        depth = d;
+        expected = count;
+        nodes = perft_split(pos, d, thread_count, move_list, counts);
+        total_nodes += nodes;
+        if (nodes != expected) {
+          ok = 0;
+          break;
+        }
+      }
+      token = strchr(token, ';');
+      token = token ? token + 1 : NULL;
+    }
+
+    if (!ok) {
+      failed++;
+      printf("%4d FAIL depth %d nodes %" PRIu64 " expected %" PRIu64 "  %s\n",
+             positions, depth, nodes, expected, line);
+    } else {
+      printf("%4d ok   depth %d nodes %" PRIu64 " time %" PRIu64 " ms  %s\n",
+             positions, depth, nodes, get_time_ms() - position_start, line);
+    }
+  }
+  fclose(in);
+  free_perft_table();
+
+  const uint64_t elapsed = get_time_ms() - start;
+  printf("\n%d positions %d passed %d failed\n", positions, positions - failed,
+         failed);
+  printf("%" PRIu64 " nodes %" PRIu64 " ms %" PRIu64 " nps\n", total_nodes,
+         elapsed, total_nodes / (elapsed + 1) * 1000);
+  return failed;
+}
@@ -2,6 +2,8 @@
 #define PERFT_H
 
 #include "structs.h"
-void perft_test(position_t* pos, thread_t *thread, int depth);
+void perft_test(position_t *pos, int depth, int thread_count);
+int perft_suite(position_t *pos, thread_t *thread, const char *path,
+                int max_depth, int thread_count);
 
 #endif
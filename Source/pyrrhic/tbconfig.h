@@ -33,9 +33,11 @@
  * not readily clear what these definfitions mean. The relevant files are
  * are the ones included below.
  *
- * Note that for the Pawn Attacks, we invert the colour. This is because
- * Pyrrhic defines White as 1, where as Ethereal (any many others) choose
- * to define White as 0 and Black as 1.
+ * Quanticade numbers squares from a8 = 0, so syzygy.c flips every bitboard
+ * vertically before handing it to Pyrrhic (which expects a1 = 0). On a
+ * flipped board a White pawn attacks the same squares our Black pawn table
+ * does, and Pyrrhic defines White as 1, so the colour is passed straight
+ * through instead of being inverted like Ethereal does.
  */
 
 #include "../attacks.h"
@@ -45,7 +47,7 @@
 #define PYRRHIC_LSB(x)                   (get_lsb(x))
 #define PYRRHIC_POPLSB(x)                (poplsb(x))
 
-#define PYRRHIC_PAWN_ATTACKS(sq, c)      (get_pawn_attacks(!c, sq))
+#define PYRRHIC_PAWN_ATTACKS(sq, c)      (get_pawn_attacks(c, sq))
 #define PYRRHIC_KNIGHT_ATTACKS(sq)       (get_knight_attacks(sq))
 #define PYRRHIC_BISHOP_ATTACKS(sq, occ)  (get_bishop_attacks(sq, occ))
 #define PYRRHIC_ROOK_ATTACKS(sq, occ)    (get_rook_attacks(sq, occ))
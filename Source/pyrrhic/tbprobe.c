@@ -264,7 +264,11 @@ enum { WDL, DTM, DTZ };
 enum { PIECE_ENC, FILE_ENC, RANK_ENC };
 
 // Attack and move generation code
+// The Zobrist primes in tbchess.c are 64-bit enumerators
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
 #include "tbchess.c"
+#pragma GCC diagnostic pop
 
 struct PairsData {
   uint8_t *indexTable;
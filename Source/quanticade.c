@@ -3,6 +3,7 @@
 #include "move.h"
 #include "movegen.h"
 #include "nnue.h"
+#include "numa.h"
 #include "search.h"
 #include "spsa.h"
 #include <stdint.h>
@@ -23,7 +24,6 @@
 #include "uci.h"
 
 position_t pos;
-limits_t limits;
 keys_t keys;
 
 extern const int default_hash_size;
@@ -85,6 +85,10 @@ void init_all(void) {
   init_hash_table(default_hash_size);
 
   nnue_init();
+
+  nnue_use_large_pages();
+
+  numa_init();
 }
 
 /**********************************\
@@ -97,8 +101,6 @@ void init_all(void) {
 
 int main(int argc, char *argv[]) {
   pos.enpassant = no_sq;
-  limits.movestogo = 30;
-  limits.time = -1;
   tt.hash_entry = NULL;
   tt.num_of_entries = 0;
   // init all
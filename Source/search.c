@@ -8,6 +8,7 @@
 #include "move.h"
 #include "movegen.h"
 #include "nnue.h"
+#include "numa.h"
 #include "pyrrhic/tbprobe.h"
 #include "see.h"
 #include "spsa.h"
@@ -22,7 +23,6 @@
 #include <inttypes.h>
 #include <limits.h>
 #include <math.h>
-#include <pthread.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -31,7 +31,6 @@
 
 extern volatile uint8_t ABORT_SIGNAL;
 
-extern int thread_count;
 
 extern keys_t keys;
 
@@ -41,6 +40,7 @@ extern TUNABLE(int QUIET_HISTORY_TT_BASE);
 
 extern uint8_t disable_norm;
 extern uint8_t minimal;
+extern uint8_t root_move_info;
 
 // Depths and untunable values (SPSA poison)
 TUNABLE(int RAZOR_DEPTH = 7);
@@ -193,8 +193,6 @@ int lmr[2][MAX_PLY + 1][256];
 
 TUNABLE(double bestmove_scale[5] = {2.4132984943657214, 1.3700453510729038, 1.099063865295098, 0.8862855915603673, 0.7146573470978642});
 
-uint64_t nodes_spent_table[4096] = {0};
-
 // Initializes the late move reduction array
 void init_reductions(void) {
   for (int depth = 0; depth <= MAX_PLY; depth++) {
@@ -212,31 +210,97 @@ void init_reductions(void) {
   }
 }
 
+static inline root_move_t *find_root_move(thread_t *thread, uint16_t move) {
+  for (int i = 0; i < thread->root_move_count; ++i) {
+    if (thread->root_moves[i].move == move) {
+      return &thread->root_moves[i];
+    }
+  }
+  return NULL;
+}
+
+// Nodes every thread of the search spent below root move index so far
+static uint64_t root_move_nodes(search_t *search, int index) {
+  uint64_t nodes = 0;
+  for (int i = 0; i < search->thread_count; ++i) {
+    nodes += atomic_load_explicit(&search->threads[i].root_moves[index].nodes,
+                                  memory_order_relaxed);
+  }
+  return nodes;
+}
+
 void scale_time(thread_t *thread, uint8_t best_move_stability,
                 uint8_t eval_stability, uint16_t move) {
+  limits_t *limits = &thread->search->limits;
+  // the share of all threads' root nodes that went to the best move
+  uint64_t move_nodes = 0, total_nodes = 0;
+  for (int i = 0; i < thread->root_move_count; ++i) {
+    const uint64_t nodes = root_move_nodes(thread->search, i);
+    total_nodes += nodes;
+    move_nodes += thread->root_moves[i].move == move ? nodes : 0;
+  }
   const double not_bm_nodes_fraction =
-      1 - (double)nodes_spent_table[move >> 4] / (double)thread->nodes;
+      1 - (double)move_nodes / (double)MAX(total_nodes, 1);
   const double node_scaling_factor =
       MAX(NODE_TIME_MULTIPLIER * not_bm_nodes_fraction + NODE_TIME_ADDITION,
           NODE_TIME_MIN);
   const double eval = EVAL_TIME_ADDITION - eval_stability * EVAL_TIME_MULTIPLIER;
-  limits.soft_limit =
-      MIN(thread->starttime + limits.base_soft *
+  limits->soft_limit =
+      MIN(thread->starttime + limits->base_soft *
                                   bestmove_scale[best_move_stability] * eval *
                                   node_scaling_factor,
-          limits.max_time + thread->starttime);
+          limits->max_time + thread->starttime);
+}
+
+// The main thread reads the clock once every time_check_interval nodes. The
+// interval follows the measured speed so the clock is read roughly every
+// TIME_CHECK_US microseconds, which bounds how late a stop can be noticed.
+#define TIME_CHECK_US 500
+#define TIME_CHECK_MIN_NODES 16
+#define TIME_CHECK_MAX_NODES 65536
+
+static void reset_time_check(search_t *search) {
+  search->next_time_check = 0;
+  search->last_time_check = get_time_us();
+  search->time_check_interval = 1024;
 }
 
 uint8_t check_time(thread_t *thread) {
+  if ((thread->nodes & 1023) == 0) {
+    publish_nodes(thread);
+  }
+
+  if (thread->index != 0) {
+    return 0;
+  }
+
+  search_t *search = thread->search;
+  const limits_t *limits = &search->limits;
+
+  if (limits->nodes_set && thread->nodes >= limits->node_limit_hard) {
+    stop_threads(search);
+    return 1;
+  }
+
+  if (!limits->timeset || thread->nodes < search->next_time_check) {
+    return 0;
+  }
+
+  const uint64_t now = get_time_us();
   // if time is up break here
-  if (thread->index == 0 &&
-      ((limits.timeset && ((thread->nodes % 1024) == 0) &&
-        get_time_ms() > limits.hard_limit) ||
-       (limits.nodes_set && thread->nodes >= limits.node_limit_hard))) {
-    // tell engine to stop calculating
-    thread->stopped = 1;
+  if (now / 1000 > limits->hard_limit) {
+    stop_threads(search);
     return 1;
   }
+
+  const uint64_t elapsed = MAX(now - search->last_time_check, 1);
+  if (search->next_time_check) {
+    search->time_check_interval =
+        clamp(search->time_check_interval * TIME_CHECK_US / elapsed,
+              TIME_CHECK_MIN_NODES, TIME_CHECK_MAX_NODES);
+  }
+  search->last_time_check = now;
+  search->next_time_check = thread->nodes + search->time_check_interval;
   return 0;
 }
 
@@ -324,7 +388,7 @@ static inline void score_noisy(thread_t *thread, searchstack_t *ss,
 
     entry.score = mvv[target_piece % 6] * MO_MVV_MULT;
     entry.score +=
-        thread->capture_history[pos->mailbox[source]][target_piece]
+        thread->tables->capture_history[pos->mailbox[source]][target_piece]
                                [target][source_threatened][target_threatened] *
         MO_CAPT_HIST_MULT;
     entry.score /= 1024;
@@ -357,13 +421,13 @@ static inline void score_quiet(thread_t *thread, searchstack_t *ss,
     const uint8_t target_threatened = is_square_threatened(ss, target);
 
     entry->score =
-        thread->quiet_history[pos->side][source][target][source_threatened]
+        thread->tables->quiet_history[pos->side][source][target][source_threatened]
                              [target_threatened] *
             MO_QUIET_HIST_MULT +
         get_conthist_score(thread, ss, move, 1) * MO_CONT1_HIST_MULT +
         get_conthist_score(thread, ss, move, 2) * MO_CONT2_HIST_MULT +
         get_conthist_score(thread, ss, move, 4) * MO_CONT4_HIST_MULT +
-        thread->pawn_history[pos->hash_keys.pawn_key % 2048]
+        thread->tables->pawn_history[pos->hash_keys.pawn_key % 2048]
                             [pos->mailbox[source]][target] *
             MO_PAWN_HIST_MULT;
     entry->score /= 1024;
@@ -497,7 +561,6 @@ static inline int16_t quiescence(thread_t *thread, searchstack_t *ss,
 
   // Check on time
   if (check_time(thread)) {
-    stop_threads(thread, thread_count);
     return 0;
   }
 
@@ -505,7 +568,7 @@ static inline int16_t quiescence(thread_t *thread, searchstack_t *ss,
   // constant
   if (ply > MAX_PLY - 4) {
     // evaluate position
-    return evaluate(thread, pos, &thread->accumulator[ply]);
+    return evaluate(thread, pos, &thread->tables->accumulator[ply]);
   }
 
   if (ply > thread->seldepth) {
@@ -522,14 +585,15 @@ static inline int16_t quiescence(thread_t *thread, searchstack_t *ss,
   uint8_t tt_flag = HASH_FLAG_EXACT;
   uint8_t tt_was_pv = pv_node;
 
-  tt_entry_t *tt_entry = read_hash_entry(pos, &tt_hit);
+  tt_entry_t tt_data;
+  tt_entry_t *tt_entry = read_hash_entry(pos, &tt_hit, &tt_data);
 
   if (tt_hit) {
-    tt_move = tt_entry->move;
-    tt_was_pv |= tt_entry->tt_pv;
-    tt_score = score_from_tt(ply, tt_entry->score);
-    tt_static_eval = tt_entry->static_eval;
-    tt_flag = tt_entry->flag;
+    tt_move = tt_data.move;
+    tt_was_pv |= tt_data.tt_pv;
+    tt_score = score_from_tt(ply, tt_data.score);
+    tt_static_eval = tt_data.static_eval;
+    tt_flag = tt_data.flag;
   }
 
   // If we arent in PV node and we hit requirements for cutoff
@@ -557,7 +621,7 @@ static inline int16_t quiescence(thread_t *thread, searchstack_t *ss,
         best_score = tt_score;
       }
     } else {
-      raw_static_eval = evaluate(thread, pos, &thread->accumulator[ply]);
+      raw_static_eval = evaluate(thread, pos, &thread->tables->accumulator[ply]);
       ss->static_eval = best_score =
           adjust_static_eval(thread, raw_static_eval);
     }
@@ -599,10 +663,6 @@ static inline int16_t quiescence(thread_t *thread, searchstack_t *ss,
   uint16_t move;
   while ((move = select_next(&picker)) != 0) {
 
-    if (!is_legal(pos, move)) {
-      continue;
-    }
-
     moves_seen++;
 
     if (!in_check && !is_loss(best_score)) {
@@ -640,7 +700,7 @@ static inline int16_t quiescence(thread_t *thread, searchstack_t *ss,
 
     ss->move = move;
     ss->piece = pos->mailbox[get_move_source(move)];
-    ss->continuation_history = thread->continuation_history[ss->piece][get_history_target(move)];
+    ss->continuation_history = thread->tables->continuation_history[ss->piece][get_history_target(move)];
 
     thread->nodes++;
 
@@ -659,7 +719,7 @@ static inline int16_t quiescence(thread_t *thread, searchstack_t *ss,
     thread->repetition_index--;
 
     // return 0 if time is up
-    if (thread->stopped == 1) {
+    if (threads_stopped(thread)) {
       return 0;
     }
 
@@ -708,6 +768,15 @@ static inline int16_t quiescence(thread_t *thread, searchstack_t *ss,
   return best_score;
 }
 
+static inline uint8_t is_tb_root_move(const moves *tb_root_moves,
+                                      uint16_t move) {
+  for (uint32_t i = 0; i < tb_root_moves->count; ++i) {
+    if (tb_root_moves->entry[i].move == move)
+      return 1;
+  }
+  return 0;
+}
+
 static inline void update_pv(PV_t *pv, uint8_t ply, uint16_t move) {
   const uint8_t child_len = pv->pv_length[ply + 1];
   pv->pv_table[ply][0] = move;
@@ -728,7 +797,7 @@ static inline int16_t negamax(thread_t *thread, searchstack_t *ss,
   // constant
   if (ply > MAX_PLY - 4) {
     // evaluate position
-    return evaluate(thread, pos, &thread->accumulator[ply]);
+    return evaluate(thread, pos, &thread->tables->accumulator[ply]);
   }
 
   // Reset PV Length for this ply so stale continuations aren't inherited
@@ -780,15 +849,16 @@ static inline int16_t negamax(thread_t *thread, searchstack_t *ss,
     return quiescence(thread, ss, alpha, beta, pv_node);
   }
 
-  tt_entry_t *tt_entry = read_hash_entry(pos, &tt_hit);
+  tt_entry_t tt_data;
+  tt_entry_t *tt_entry = read_hash_entry(pos, &tt_hit, &tt_data);
 
   if (tt_hit) {
-    ss->tt_pv |= tt_entry->tt_pv;
-    tt_score = score_from_tt(ply, tt_entry->score);
-    tt_static_eval = tt_entry->static_eval;
-    tt_depth = tt_entry->depth;
-    tt_flag = tt_entry->flag;
-    tt_move = tt_entry->move;
+    ss->tt_pv |= tt_data.tt_pv;
+    tt_score = score_from_tt(ply, tt_data.score);
+    tt_static_eval = tt_data.static_eval;
+    tt_depth = tt_data.depth;
+    tt_flag = tt_data.flag;
+    tt_move = tt_data.move;
   }
 
   // If we arent in excluded move or PV node and we hit requirements for cutoff
@@ -806,6 +876,49 @@ static inline int16_t negamax(thread_t *thread, searchstack_t *ss,
     return tt_score;
   }
 
+  int16_t best_score = NO_SCORE;
+  int16_t max_score = INF;
+
+  // Syzygy tablebase probing
+  if (!root_node && !ss->excluded_move && can_probe_wdl(pos, depth)) {
+    const unsigned wdl = quant_probe_wdl(pos);
+
+    if (wdl != TB_RESULT_FAILED) {
+      thread->tbhits++;
+
+      int16_t tb_score;
+      uint8_t tb_bound;
+      if (wdl == TB_LOSS) {
+        tb_score = -TB_WIN_SCORE + ply;
+        tb_bound = HASH_FLAG_UPPER_BOUND;
+      } else if (wdl == TB_WIN) {
+        tb_score = TB_WIN_SCORE - ply;
+        tb_bound = HASH_FLAG_LOWER_BOUND;
+      } else {
+        tb_score = 0;
+        tb_bound = HASH_FLAG_EXACT;
+      }
+
+      if (tb_bound == HASH_FLAG_EXACT ||
+          (tb_bound == HASH_FLAG_LOWER_BOUND && tb_score >= beta) ||
+          (tb_bound == HASH_FLAG_UPPER_BOUND && tb_score <= alpha)) {
+        write_hash_entry(tt_entry, pos, ply, tb_score, NO_SCORE,
+                         MIN(depth + 6, MAX_PLY - 1), 0, tb_bound, ss->tt_pv);
+        return tb_score;
+      }
+
+      // In PV nodes the tablebase score only bounds the search result
+      if (pv_node) {
+        if (tb_bound == HASH_FLAG_LOWER_BOUND) {
+          best_score = tb_score;
+          alpha = MAX(alpha, best_score);
+        } else {
+          max_score = tb_score;
+        }
+      }
+    }
+  }
+
   if (in_check) {
     ss->static_eval = NO_SCORE;
     raw_static_eval = NO_SCORE;
@@ -815,7 +928,7 @@ static inline int16_t negamax(thread_t *thread, searchstack_t *ss,
   } else if (tt_hit) {
     raw_static_eval = tt_static_eval != NO_SCORE
                           ? tt_static_eval
-                          : evaluate(thread, pos, &thread->accumulator[ply]);
+                          : evaluate(thread, pos, &thread->tables->accumulator[ply]);
     ss->eval = ss->static_eval = adjust_static_eval(thread, raw_static_eval);
 
     if (tt_score != NO_SCORE &&
@@ -825,7 +938,7 @@ static inline int16_t negamax(thread_t *thread, searchstack_t *ss,
       ss->eval = tt_score;
     }
   } else {
-    raw_static_eval = evaluate(thread, pos, &thread->accumulator[ply]);
+    raw_static_eval = evaluate(thread, pos, &thread->tables->accumulator[ply]);
     ss->eval = ss->static_eval = adjust_static_eval(thread, raw_static_eval);
 
     write_hash_entry(tt_entry, pos, ply, NO_SCORE, raw_static_eval, 0, 0,
@@ -855,7 +968,6 @@ static inline int16_t negamax(thread_t *thread, searchstack_t *ss,
 
   // Check on time
   if (check_time(thread)) {
-    stop_threads(thread, thread_count);
     return 0;
   }
 
@@ -935,7 +1047,7 @@ static inline int16_t negamax(thread_t *thread, searchstack_t *ss,
     null_pos->checkers = 0;
     null_pos->checker_count = 0;
     (ss + 1)->null_move = 1;
-    ss->continuation_history = thread->continuation_history[0][0];
+    ss->continuation_history = thread->tables->continuation_history[0][0];
 
     calculate_threats(null_pos, ss + 1);
 
@@ -951,7 +1063,7 @@ static inline int16_t negamax(thread_t *thread, searchstack_t *ss,
     thread->repetition_index--;
 
     // return 0 if time is up
-    if (thread->stopped == 1) {
+    if (threads_stopped(thread)) {
       return 0;
     }
 
@@ -997,10 +1109,6 @@ static inline int16_t negamax(thread_t *thread, searchstack_t *ss,
         continue;
       }
 
-      if (!is_legal(pos, move)) {
-        continue;
-      }
-
       // Copy current position to the next ply slot and advance.
       thread->positions[++thread->ply] = *pos;
       position_t *next_pos = &thread->positions[thread->ply];
@@ -1018,7 +1126,7 @@ static inline int16_t negamax(thread_t *thread, searchstack_t *ss,
 
       ss->move = move;
       ss->piece = pos->mailbox[get_move_source(move)];
-      ss->continuation_history = thread->continuation_history[ss->piece][get_history_target(move)];
+      ss->continuation_history = thread->tables->continuation_history[ss->piece][get_history_target(move)];
 
       thread->nodes++;
 
@@ -1040,7 +1148,7 @@ static inline int16_t negamax(thread_t *thread, searchstack_t *ss,
       thread->repetition_index--;
 
       // Check if we need to stop
-      if (thread->stopped == 1) {
+      if (threads_stopped(thread)) {
         return 0;
       }
 
@@ -1121,8 +1229,6 @@ static inline int16_t negamax(thread_t *thread, searchstack_t *ss,
   quiet_list->count = 0;
   capture_list->count = 0;
 
-  int16_t best_score = NO_SCORE;
-
   uint16_t best_move = 0;
 
   uint8_t bound = HASH_FLAG_UPPER_BOUND;
@@ -1137,7 +1243,8 @@ static inline int16_t negamax(thread_t *thread, searchstack_t *ss,
       continue;
     }
 
-    if (!is_legal(pos, move)) {
+    if (root_node && thread->search->tb_root_moves.count &&
+        !is_tb_root_move(&thread->search->tb_root_moves, move)) {
       continue;
     }
 
@@ -1145,7 +1252,7 @@ static inline int16_t negamax(thread_t *thread, searchstack_t *ss,
 
     ss->history_score =
         quiet
-            ? thread->quiet_history[pos->side][get_move_source(move)]
+            ? thread->tables->quiet_history[pos->side][get_move_source(move)]
                                    [get_history_target(move)][is_square_threatened(
                                        ss, get_move_source(move))]
                                    [is_square_threatened(
@@ -1155,7 +1262,7 @@ static inline int16_t negamax(thread_t *thread, searchstack_t *ss,
                       SEARCH_CONT1_HIST_MULT +
                   get_conthist_score(thread, ss, move, 2) *
                       SEARCH_CONT2_HIST_MULT
-            : thread->capture_history
+            : thread->tables->capture_history
                           [pos->mailbox[get_move_source(move)]]
                           [pos->mailbox[get_move_target(move)]]
                           [get_move_target(move)]
@@ -1241,7 +1348,7 @@ static inline int16_t negamax(thread_t *thread, searchstack_t *ss,
 
     ss->move = move;
     ss->piece = pos->mailbox[get_move_source(move)];
-    ss->continuation_history = thread->continuation_history[ss->piece][get_history_target(move)];
+    ss->continuation_history = thread->tables->continuation_history[ss->piece][get_history_target(move)];
 
     // increment nodes count
     thread->nodes++;
@@ -1314,12 +1421,26 @@ static inline int16_t negamax(thread_t *thread, searchstack_t *ss,
     thread->ply--;
     thread->repetition_index--;
 
-    if (thread->index == 0 && root_node) {
-      nodes_spent_table[move >> 4] += thread->nodes - nodes_before_search;
+    if (root_node) {
+      root_move_t *root_move = find_root_move(thread, move);
+      if (root_move) {
+        atomic_store_explicit(
+            &root_move->nodes,
+            atomic_load_explicit(&root_move->nodes, memory_order_relaxed) +
+                thread->nodes - nodes_before_search,
+            memory_order_relaxed);
+        if (!threads_stopped(thread)) {
+          root_move->score = score;
+          root_move->depth = depth;
+          root_move->bound = score <= alpha  ? HASH_FLAG_UPPER_BOUND
+                             : score >= beta ? HASH_FLAG_LOWER_BOUND
+                                             : HASH_FLAG_EXACT;
+        }
+      }
     }
 
     // return 0 if time is up
-    if (thread->stopped == 1) {
+    if (threads_stopped(thread)) {
       return 0;
     }
 
@@ -1418,6 +1539,10 @@ static inline int16_t negamax(thread_t *thread, searchstack_t *ss,
     best_score = (best_score * depth + beta) / (depth + 1);
   }
 
+  if (pv_node) {
+    best_score = MIN(best_score, max_score);
+  }
+
   if (!ss->excluded_move) {
     // store hash entry with the score equal to alpha
     write_hash_entry(tt_entry, pos, ply, best_score, raw_static_eval, depth,
@@ -1435,22 +1560,18 @@ static inline int16_t negamax(thread_t *thread, searchstack_t *ss,
   return best_score;
 }
 
-static void print_thinking(thread_t *thread, int16_t score,
-                           uint8_t current_depth) {
-
-  const uint64_t nodes = total_nodes(thread, thread_count);
-  const uint64_t time = get_time_ms() - thread->starttime;
-  const uint64_t nps = (nodes / fmax(time, 1)) * 1000;
-
-  printf("info depth %d seldepth %d score ", current_depth, thread->seldepth);
-
-  if (score > -MATE_VALUE && score < -MATE_SCORE) {
-    printf("mate %d ", -(MATE_VALUE - abs(score) + 1) / 2);
-  } else if (score > MATE_SCORE && score < MATE_VALUE) {
-    printf("mate %d ", (MATE_VALUE - abs(score) + 1) / 2);
+// Writes the score as UCI reports it, "cp <x>" or "mate <n>"
+void format_score(char *out, size_t size, thread_t *thread, int16_t score) {
+  if (score > -MATE_VALUE && score < -TB_WIN_SCORE) {
+    snprintf(out, size, "mate %d", -(MATE_VALUE - abs(score) + 1) / 2);
+  } else if (score > TB_WIN_SCORE && score < MATE_VALUE) {
+    snprintf(out, size, "mate %d", (MATE_VALUE - abs(score) + 1) / 2);
+  } else if (is_decisive(score)) {
+    // tablebase win or loss, too far from mate to print one
+    snprintf(out, size, "cp %d", score);
   } else {
     if (disable_norm) {
-      printf("cp %d ", score);
+      snprintf(out, size, "cp %d", score);
     } else {
       position_t *pos = &thread->positions[thread->ply];
       const uint16_t material = 1 * popcount(pos->bitboards[p] | pos->bitboards[P]) +
@@ -1459,19 +1580,38 @@ static void print_thinking(thread_t *thread, int16_t score,
                                 5 * popcount(pos->bitboards[r] | pos->bitboards[R]) + 
                                 9 * popcount(pos->bitboards[q] | pos->bitboards[Q]);
       const int16_t norm_score = wdl_normalize_score(score, material);
-      printf("cp %d ", norm_score);
+      snprintf(out, size, "cp %d", norm_score);
     }
   }
+}
+
+// Prints the last iteration thread finished
+static void print_thinking(thread_t *thread) {
+  const int16_t score = thread->completed_score;
+  const uint8_t current_depth = thread->completed_depth;
+
+  publish_nodes(thread);
+  search_t *search = thread->search;
+  const uint64_t nodes = total_nodes(search->threads, search->thread_count);
+  // only the main thread has the start time
+  const uint64_t time = get_time_ms() - search->threads[0].starttime;
+  const uint64_t nps = (nodes / fmax(time, 1)) * 1000;
+
+  char score_string[16];
+  format_score(score_string, sizeof(score_string), thread, score);
+  printf("info depth %d seldepth %d score %s ", current_depth,
+         thread->seldepth, score_string);
   printf("nodes %" PRIu64 " ", nodes);
   printf("nps %" PRIu64 " ", nps);
   printf("hashfull %d ", hash_full());
+  printf("tbhits %" PRIu64 " ", total_tbhits(search->threads, search->thread_count));
   printf("time %" PRIu64 " ", time);
   printf("pv ");
 
   // loop over the moves within a PV line
-  for (int count = 0; count < thread->pv.pv_length[0]; count++) {
+  for (int count = 0; count < thread->completed_pv_length; count++) {
     // print PV move
-    print_move(thread->pv.pv_table[0][count]);
+    print_move(thread->completed_pv[count]);
     printf(" ");
   }
 
@@ -1479,19 +1619,72 @@ static void print_thinking(thread_t *thread, int16_t score,
   printf("\n");
 }
 
+// Prints what the threads spent on and found for every root move, the moves
+// with the most nodes first. The score is from the thread that searched the
+// move deepest.
+static void print_root_moves(search_t *search) {
+  const thread_t *main_thread = &search->threads[0];
+  const int count = main_thread->root_move_count;
+  uint64_t nodes[MAX_ROOT_MOVES];
+  int order[MAX_ROOT_MOVES];
+  uint64_t total_nodes = 0;
+
+  for (int i = 0; i < count; ++i) {
+    nodes[i] = root_move_nodes(search, i);
+    total_nodes += nodes[i];
+    int j = i;
+    for (; j > 0 && nodes[order[j - 1]] < nodes[i]; --j) {
+      order[j] = order[j - 1];
+    }
+    order[j] = i;
+  }
+
+  for (int i = 0; i < count; ++i) {
+    const int index = order[i];
+    const root_move_t *deepest = &main_thread->root_moves[index];
+    for (int t = 1; t < search->thread_count; ++t) {
+      if (search->threads[t].root_moves[index].depth > deepest->depth) {
+        deepest = &search->threads[t].root_moves[index];
+      }
+    }
+
+    char move[6];
+    format_move(move, deepest->move);
+    printf("info string rootmove %s nodes %" PRIu64 " share %.1f%%", move,
+           nodes[index], 100.0 * nodes[index] / MAX(total_nodes, 1));
+    if (deepest->depth) {
+      char score[16];
+      format_score(score, sizeof(score), (thread_t *)main_thread,
+                   deepest->score);
+      printf(" depth %d score %s%s", deepest->depth, score,
+             deepest->bound == HASH_FLAG_UPPER_BOUND   ? " upperbound"
+             : deepest->bound == HASH_FLAG_LOWER_BOUND ? " lowerbound"
+                                                       : "");
+    }
+    printf("\n");
+  }
+}
+
 void *iterative_deepening(void *thread_void) {
   thread_t *thread = (thread_t *)thread_void;
   position_t *pos = &thread->positions[0];
+  search_t *search = thread->search;
+  limits_t *limits = &search->limits;
 
   uint16_t prev_best_move = 0;
   int16_t average_score = NO_SCORE;
   uint8_t best_move_stability = 0;
   uint8_t eval_stability = 0;
 
+  // built here rather than in search_position so the tables are first
+  // touched by the cpu the thread is bound to
+  init_accumulator(pos, thread->tables->accumulator);
+  init_finny_tables(thread, pos);
+
   // iterative deepening
-  for (thread->depth = 1; thread->depth <= limits.depth; thread->depth++) {
+  for (thread->depth = 1; thread->depth <= limits->depth; thread->depth++) {
     // if time is up
-    if (thread->stopped == 1) {
+    if (threads_stopped(thread)) {
       // stop calculating and return best move so far
       break;
     }
@@ -1532,11 +1725,10 @@ void *iterative_deepening(void *thread_void) {
     while (true) {
 
       if (check_time(thread)) {
-        stop_threads(thread, thread_count);
         break;
       }
 
-      if (thread->stopped) {
+      if (threads_stopped(thread)) {
         break;
       }
 
@@ -1548,7 +1740,7 @@ void *iterative_deepening(void *thread_void) {
 
       // We hit an aspiration window cut-off before time ran out and we jumped
       // to another depth with wider search which we didnt finish
-      if (thread->stopped) {
+      if (threads_stopped(thread)) {
         return NULL;
       }
 
@@ -1576,8 +1768,13 @@ void *iterative_deepening(void *thread_void) {
       }
     }
 
-    if (!thread->stopped) {
+    const uint8_t completed = !threads_stopped(thread);
+    if (completed) {
       thread->completed_depth = thread->depth;
+      thread->completed_score = thread->score;
+      thread->completed_pv_length = thread->pv.pv_length[0];
+      memcpy(thread->completed_pv, thread->pv.pv_table[0],
+             thread->pv.pv_length[0] * sizeof(uint16_t));
     }
 
     if (thread->index == 0) {
@@ -1595,53 +1792,158 @@ void *iterative_deepening(void *thread_void) {
         eval_stability = 0;
       }
 
-      if (limits.timeset && thread->depth > 7) {
+      if (limits->timeset && thread->depth > 7) {
         scale_time(thread, best_move_stability, eval_stability,
                    thread->pv.pv_table[0][0]);
       }
     }
 
     if (thread->index == 0 &&
-        ((limits.timeset && get_time_ms() >= limits.soft_limit) ||
-         (limits.nodes_set && thread->nodes >= limits.node_limit_soft))) {
-      stop_threads(thread, thread_count);
+        ((limits->timeset && get_time_ms() >= limits->soft_limit) ||
+         (limits->nodes_set && thread->nodes >= limits->node_limit_soft))) {
+      stop_threads(search);
     }
 
-    if (thread->index == 0 && !minimal) {
+    if (thread->index == 0 && !minimal && !search->silent) {
       // if PV is available
-      if (thread->pv.pv_length[0]) {
+      if (completed && thread->completed_pv_length) {
         // print search info
-        print_thinking(thread, thread->score, thread->depth);
+        print_thinking(thread);
+      }
+      if (root_move_info) {
+        print_root_moves(search);
       }
     }
 
-    if (thread->stopped) {
+    if (threads_stopped(thread)) {
       return NULL;
     }
   }
   return NULL;
 }
 
+// whether the game has repeated a position since the last zeroing move
+static uint8_t has_repeated(thread_t *thread) {
+  const position_t *pos = &thread->positions[thread->ply];
+  const uint32_t end = thread->repetition_index;
+  const uint32_t start = end - MIN(end, (uint32_t)pos->fifty);
+
+  for (uint32_t i = start + 1; i <= end; ++i) {
+    for (uint32_t j = start; j < i; ++j) {
+      if (thread->repetition_table[i] == thread->repetition_table[j])
+        return 1;
+    }
+  }
+  return 0;
+}
+
+// The move of the last iteration thread finished. A search stopped before
+// its first iteration finished falls back on the first legal move.
+uint16_t thread_best_move(const thread_t *thread) {
+  if (thread->completed_pv_length) {
+    return thread->completed_pv[0];
+  }
+  return thread->root_move_count ? thread->root_moves[0].move : 0;
+}
+
+// Picks the thread whose root move the search plays. Every thread votes for
+// the move it ended on with a weight growing with its depth and with how far
+// its score is above the worst one. A proven win is taken from the thread
+// with the shortest one, and a proven loss is only played when no thread
+// sees anything better, from the thread that holds out longest.
+static thread_t *select_best_thread(search_t *search) {
+  thread_t *threads = search->threads;
+  const int thread_count = search->thread_count;
+
+  if (thread_count == 1 || !threads[0].completed_pv_length) {
+    return &threads[0];
+  }
+
+  int16_t min_score = INF;
+  for (int i = 0; i < thread_count; ++i) {
+    if (threads[i].completed_pv_length) {
+      min_score = MIN(min_score, threads[i].completed_score);
+    }
+  }
+
+  // votes[i] adds up the weights of every thread on the move of thread i
+  int64_t votes[MAX_THREADS] = {0};
+  for (int i = 0; i < thread_count; ++i) {
+    if (!threads[i].completed_pv_length) {
+      continue;
+    }
+    const int64_t weight =
+        (int64_t)(threads[i].completed_score - min_score + 14) *
+        threads[i].completed_depth;
+    for (int j = 0; j < thread_count; ++j) {
+      if (threads[j].completed_pv_length &&
+          threads[j].completed_pv[0] == threads[i].completed_pv[0]) {
+        votes[j] += weight;
+      }
+    }
+  }
+
+  int best = 0;
+  for (int i = 1; i < thread_count; ++i) {
+    if (!threads[i].completed_pv_length) {
+      continue;
+    }
+    const int16_t best_score = threads[best].completed_score;
+    const int16_t score = threads[i].completed_score;
+
+    if (is_decisive(best_score)) {
+      // the shortest win, or anything better than the loss
+      if (score > best_score) {
+        best = i;
+      }
+    } else if (is_win(score) || (!is_loss(score) && votes[i] > votes[best])) {
+      best = i;
+    }
+  }
+
+  return &threads[best];
+}
+
 // search position for the best move
 // TODO: Pass in const ply so we can always restore it to
 // original without search changing it
-void search_position(position_t *pos, thread_t *threads) {
-  increment_tt_age();
+void search_position(search_t *search, position_t *pos) {
+  thread_t *threads = search->threads;
+  const int thread_count = search->thread_count;
+
+  // the helpers are bound by the thread pool, bind the main search thread
+  numa_bind_thread(search->first_worker);
+
+  moves root_list[1];
+  generate_noisy(pos, root_list, 0);
+  generate_quiets(pos, root_list, 1);
 
-  pthread_t pthreads[thread_count];
   for (int i = 0; i < thread_count; ++i) {
+    threads[i].search = search;
     threads[i].nodes = 0;
-    threads[i].stopped = 0;
+    threads[i].tbhits = 0;
+    threads[i].eval_cache_probes = 0;
+    threads[i].eval_cache_hits = 0;
+    publish_nodes(&threads[i]);
     threads[i].positions[threads[0].ply] = *pos;
     threads[i].ply = threads[0].ply;
     threads[i].score = -INF;
     threads[i].quit = 0;
     threads[i].nmp_min_ply = 0;
     threads[i].completed_depth = 0;
+    threads[i].completed_score = -INF;
+    threads[i].completed_pv_length = 0;
+    threads[i].root_move_count = root_list->count;
+    for (uint32_t j = 0; j < root_list->count; ++j) {
+      root_move_t *root_move = &threads[i].root_moves[j];
+      atomic_init(&root_move->nodes, 0);
+      root_move->move = root_list->entry[j].move;
+      root_move->score = -INF;
+      root_move->bound = HASH_FLAG_NONE;
+      root_move->depth = 0;
+    }
     memset(&threads[i].pv, 0, sizeof(threads[i].pv));
     memset(&threads[i].neurons, 0, sizeof(simd_t));
-    init_accumulator(pos, threads[i].accumulator);
-    init_finny_tables(&threads[i], pos);
     if (i > 0) {
       threads[i].repetition_index = threads[0].repetition_index;
       memcpy(threads[i].repetition_table, threads[0].repetition_table,
@@ -1649,30 +1951,60 @@ void search_position(position_t *pos, thread_t *threads) {
     }
   }
 
-  // clear helper data structures for search
-  memset(nodes_spent_table, 0, sizeof(nodes_spent_table));
+  clear_stop(search);
+  reset_time_check(search);
+
+  // restrict the root to moves that preserve the tablebase result
+  search->tb_root_moves.count = 0;
+  if (TB_LARGEST && quant_probe_root(pos, has_repeated(&threads[0]),
+                                     &search->tb_root_moves)) {
+    threads[0].tbhits++;
+  }
 
+  // a helper the pool cannot grow to sits the search out, it never finishes
+  // an iteration so it gets no say in the result
   for (int thread_index = 1; thread_index < thread_count; ++thread_index) {
-    pthread_create(&pthreads[thread_index], NULL, &iterative_deepening,
-                   &threads[thread_index]);
+    thread_pool_start(search->first_worker + thread_index - 1,
+                      &iterative_deepening, &threads[thread_index]);
   }
 
   iterative_deepening(&threads[0]);
 
-  stop_threads(threads, thread_count);
+  stop_threads(search);
 
-  for (int i = 1; i < thread_count; ++i) {
-    pthread_join(pthreads[i], NULL);
+  thread_pool_wait_range(search->first_worker, thread_count - 1);
+
+  thread_t *best = search->best_thread = select_best_thread(search);
+
+  if (search->silent) {
+    return;
   }
 
-  if (threads[0].pv.pv_length[0] > 0 && (minimal || threads[0].completed_depth == 0)) {
-    print_thinking(&threads[0], threads[0].score, MAX(1, threads[0].depth - 1));
+  // the last line the GUI saw is from the main thread, if any was printed
+  if (best->completed_pv_length && (best != &threads[0] || minimal)) {
+    print_thinking(best);
+  }
+
+#if EVAL_CACHE_SIZE
+  // every thread has its own cache, the totals show how well they are sized
+  // for this thread count
+  uint64_t eval_cache_probes = 0, eval_cache_hits = 0;
+  for (int i = 0; i < thread_count; ++i) {
+    eval_cache_probes += threads[i].eval_cache_probes;
+    eval_cache_hits += threads[i].eval_cache_hits;
   }
+  printf("info string eval cache probes %" PRIu64 " hits %" PRIu64
+         " (%.1f%%)\n",
+         eval_cache_probes, eval_cache_hits,
+         eval_cache_probes ? 100.0 * eval_cache_hits / eval_cache_probes
+                           : 0.0);
+#endif
 
   // print best move
   printf("bestmove ");
-  if (threads->pv.pv_table[0][0]) {
-    print_move(threads->pv.pv_table[0][0]);
+  const uint16_t best_move = thread_best_move(best);
+  if (best_move) {
+    print_move(best_move);
   } else {
     printf("(none)");
   }
@@ -2,7 +2,9 @@
 #define SEARCH_H
 
 #include "structs.h"
-void search_position(position_t *pos, thread_t *thread);
+void search_position(search_t *search, position_t *pos);
 void init_reductions(void);
+void format_score(char *out, size_t size, thread_t *thread, int16_t score);
+uint16_t thread_best_move(const thread_t *thread);
 
 #endif
@@ -0,0 +1,323 @@
+#include "server.h"
+#include "bitboards.h"
+#include "enums.h"
+#include "search.h"
+#include "structs.h"
+#include "threads.h"
+#include "transposition.h"
+#include "uci.h"
+#include "utils.h"
+#include <ctype.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Batch analysis mode. Jobs are read from stdin as one flat JSON object per
+// line, for example
+//   {"id": 7, "fen": "<fen>", "moves": "e2e4 e7e5", "go": "nodes 100000"}
+// where "go" takes the same limits as the UCI go command. Up to jobs
+// searches run side by side, each with its own threads, limits and stop flag,
+// all of them sharing the transposition table. Every job is answered with a
+// single JSON line carrying its id, in the order the searches finish. The id
+// is a number, true, false, null or a string without escapes, at most 127
+// characters as written.
+
+#define QUEUE_SIZE 64
+#define LINE_SIZE 10000
+
+typedef struct {
+  char id[128];
+  char position[LINE_SIZE + 32];
+  char go[256];
+} server_job_t;
+
+typedef struct {
+  search_t search;
+  position_t pos;
+  pthread_t thread;
+} server_slot_t;
+
+static server_job_t queue[QUEUE_SIZE];
+static int queue_head = 0;
+static int queue_count = 0;
+static uint8_t queue_closed = 0;
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_not_empty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t queue_not_full = PTHREAD_COND_INITIALIZER;
+
+static void push_job(const server_job_t *job) {
+  pthread_mutex_lock(&queue_mutex);
+  while (queue_count == QUEUE_SIZE) {
+    pthread_cond_wait(&queue_not_full, &queue_mutex);
+  }
+  queue[(queue_head + queue_count) % QUEUE_SIZE] = *job;
+  queue_count++;
+  pthread_cond_signal(&queue_not_empty);
+  pthread_mutex_unlock(&queue_mutex);
+}
+
+// Returns 0 once the queue is closed and drained
+static uint8_t pop_job(server_job_t *job) {
+  pthread_mutex_lock(&queue_mutex);
+  while (queue_count == 0 && !queue_closed) {
+    pthread_cond_wait(&queue_not_empty, &queue_mutex);
+  }
+  const uint8_t popped = queue_count > 0;
+  if (popped) {
+    *job = queue[queue_head];
+    queue_head = (queue_head + 1) % QUEUE_SIZE;
+    queue_count--;
+    pthread_cond_signal(&queue_not_full);
+  }
+  pthread_mutex_unlock(&queue_mutex);
+  return popped;
+}
+
+static void close_queue(void) {
+  pthread_mutex_lock(&queue_mutex);
+  queue_closed = 1;
+  pthread_cond_broadcast(&queue_not_empty);
+  pthread_mutex_unlock(&queue_mutex);
+}
+
+// Copies the value of key in a flat JSON object to out. Strings are unescaped
+// unless raw is set, raw keeps the value as written so the id can be echoed
+// back unchanged. Returns 0 if the key is missing.
+static uint8_t json_field(const char *line, const char *key, char *out,
+                          size_t size, uint8_t raw) {
+  char pattern[64];
+  snprintf(pattern, sizeof(pattern), "\"%s\"", key);
+  const char *value = strstr(line, pattern);
+  if (!value) {
+    return 0;
+  }
+  value += strlen(pattern);
+  while (*value == ' ' || *value == '\t')
+    value++;
+  if (*value++ != ':') {
+    return 0;
+  }
+  while (*value == ' ' || *value == '\t')
+    value++;
+
+  size_t length = 0;
+  if (*value == '"') {
+    const char *c = value + 1;
+    while (*c && *c != '"') {
+      if (*c == '\\' && c[1]) {
+        c++;
+      }
+      if (!raw && length + 1 < size) {
+        out[length++] = *c;
+      }
+      c++;
+    }
+    if (*c != '"') {
+      return 0;
+    }
+    if (raw) {
+      length = MIN((size_t)(c + 1 - value), size - 1);
+      memcpy(out, value, length);
+    }
+  } else {
+    while (value[length] && !strchr(",}\r\n", value[length]) &&
+           length + 1 < size) {
+      out[length] = value[length];
+      length++;
+    }
+    while (length && (out[length - 1] == ' ' || out[length - 1] == '\t'))
+      length--;
+  }
+  out[length] = '\0';
+  return length > 0;
+}
+
+// The id is echoed back as written, so it has to be a JSON value that needs
+// no escaping: a string without escapes or control characters, a number,
+// true, false or null
+static uint8_t valid_id(const char *id) {
+  if (*id == '"') {
+    for (const char *c = id + 1; *c != '"'; c++) {
+      if (*c == '\\' || (unsigned char)*c < 0x20) {
+        return 0;
+      }
+    }
+    return 1;
+  }
+  if (!strcmp(id, "true") || !strcmp(id, "false") || !strcmp(id, "null")) {
+    return 1;
+  }
+
+  const char *digits = "0123456789";
+  const char *c = id + (*id == '-');
+  if (!isdigit((unsigned char)*c)) {
+    return 0;
+  }
+  c += strspn(c, digits);
+  if (*c == '.') {
+    if (!isdigit((unsigned char)*++c)) {
+      return 0;
+    }
+    c += strspn(c, digits);
+  }
+  if (*c == 'e' || *c == 'E') {
+    c += c[1] == '+' || c[1] == '-' ? 2 : 1;
+    if (!isdigit((unsigned char)*c)) {
+      return 0;
+    }
+    c += strspn(c, digits);
+  }
+  return *c == '\0';
+}
+
+// Returns the error to answer the job with, NULL if the job can run
+static const char *parse_job(const char *line, server_job_t *job) {
+  char id[LINE_SIZE];
+  char fen[256];
+  char moves[LINE_SIZE];
+
+  strcpy(job->id, "null");
+  if (json_field(line, "id", id, sizeof(id), 1)) {
+    if (strlen(id) >= sizeof(job->id) || !valid_id(id)) {
+      return "invalid id";
+    }
+    strcpy(job->id, id);
+  }
+  if (!json_field(line, "go", job->go, sizeof(job->go), 0)) {
+    return "missing go";
+  }
+
+  if (json_field(line, "fen", fen, sizeof(fen), 0)) {
+    snprintf(job->position, sizeof(job->position), "position fen %s", fen);
+  } else {
+    strcpy(job->position, "position startpos");
+  }
+  if (json_field(line, "moves", moves, sizeof(moves), 0)) {
+    strcat(job->position, " moves ");
+    strncat(job->position, moves,
+            sizeof(job->position) - strlen(job->position) - 1);
+  }
+  return NULL;
+}
+
+static void run_job(server_slot_t *slot, server_job_t *job) {
+  search_t *search = &slot->search;
+  thread_t *thread = search->threads;
+  position_t *pos = &slot->pos;
+
+  parse_position(pos, thread, job->position);
+  if (popcount(pos->bitboards[K]) != 1 || popcount(pos->bitboards[k]) != 1) {
+    printf("{\"id\":%s,\"error\":\"invalid position\"}\n", job->id);
+    return;
+  }
+
+  time_control(search, pos, job->go);
+  search_position(search, pos);
+  const thread_t *best = search->best_thread;
+
+  // the helpers are parked again, their counts can be read directly
+  uint64_t nodes = 0;
+  for (int i = 0; i < search->thread_count; ++i) {
+    nodes += search->threads[i].nodes;
+  }
+
+  // the stop lands inside an iteration, so the result is the one of the last
+  // iteration the best thread finished, like the UCI bestmove
+  char bestmove[8] = "(none)";
+  const uint16_t best_move = thread_best_move(best);
+  if (best_move) {
+    format_move(bestmove, best_move);
+  }
+  char pv[MAX_PLY * 6 + 1] = "";
+  for (int i = 0; i < best->completed_pv_length; ++i) {
+    char move[6];
+    format_move(move, best->completed_pv[i]);
+    if (i > 0) {
+      strcat(pv, " ");
+    }
+    strcat(pv, move);
+  }
+
+  char score[16];
+  format_score(score, sizeof(score), thread,
+               best->completed_depth ? best->completed_score : best->score);
+
+  // a single printf per job so lines from different slots never interleave
+  printf("{\"id\":%s,\"bestmove\":\"%s\",\"score\":\"%s\",\"depth\":%d,"
+         "\"seldepth\":%d,\"nodes\":%" PRIu64 ",\"time\":%" PRIu64
+         ",\"pv\":\"%s\"}\n",
+         job->id, bestmove, score, best->completed_depth, best->seldepth,
+         nodes, get_time_ms() - thread->starttime, pv);
+}
+
+static void *run_slot(void *arg) {
+  server_slot_t *slot = (server_slot_t *)arg;
+  server_job_t job;
+  while (pop_job(&job)) {
+    run_job(slot, &job);
+  }
+  return NULL;
+}
+
+void serve(int jobs, int threads) {
+  // helpers of slot i use pool workers i * (threads - 1) and up
+  resize_thread_pool(jobs * (threads - 1));
+
+  server_slot_t *slots = (server_slot_t *)alloc_aligned(
+      _Alignof(server_slot_t), jobs * sizeof(server_slot_t));
+  if (!slots) {
+    fprintf(stderr, "Server slot allocation failed.\n");
+    return;
+  }
+  memset(slots, 0, jobs * sizeof(server_slot_t));
+
+  int started = 0;
+  for (; started < jobs; ++started) {
+    server_slot_t *slot = &slots[started];
+    slot->search.threads = init_threads(threads);
+    if (!slot->search.threads) {
+      break;
+    }
+    slot->search.thread_count = threads;
+    slot->search.first_worker = started * (threads - 1);
+    slot->search.silent = 1;
+    pthread_create(&slot->thread, NULL, run_slot, slot);
+  }
+
+  char line[LINE_SIZE];
+  while (started && fgets(line, sizeof(line), stdin)) {
+    // drop lines too long for the buffer like the UCI loop does
+    if (!strchr(line, '\n') && !feof(stdin)) {
+      int ch;
+      while ((ch = getchar()) != '\n' && ch != EOF)
+        ;
+      continue;
+    }
+    if (!strchr(line, '{')) {
+      continue;
+    }
+
+    server_job_t job;
+    const char *error = parse_job(line, &job);
+    if (error) {
+      printf("{\"id\":%s,\"error\":\"%s\"}\n", job.id, error);
+      continue;
+    }
+
+    // every job is a new search generation. Only this thread writes the age,
+    // searches already running just see their entries age a little sooner.
+    increment_tt_age();
+    push_job(&job);
+  }
+
+  close_queue();
+  for (int i = 0; i < started; ++i) {
+    pthread_join(slots[i].thread, NULL);
+    free_threads(slots[i].search.threads, threads);
+  }
+
+  free_aligned(slots);
+  resize_thread_pool(0);
+}
@@ -0,0 +1,6 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+void serve(int jobs, int threads);
+
+#endif
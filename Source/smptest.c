@@ -0,0 +1,212 @@
+#include "smptest.h"
+#include "bitboards.h"
+#include "enums.h"
+#include "movegen.h"
+#include "search.h"
+#include "structs.h"
+#include "threads.h"
+#include "transposition.h"
+#include "uci.h"
+#include "utils.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Fixed node self-play measuring what Lazy SMP threads are worth. For every
+// thread count, an engine searching with that many threads plays one
+// searching with a single thread from each opening, once with each color.
+// Both get the same node limit, which go nodes counts on the main thread, so
+// every thread searches about as many nodes as the single one. That is the
+// equal time per thread of a machine with a core for every thread, on fewer
+// cores the helpers fall behind and the result understates the scaling.
+
+#define SMP_MAX_PLIES 400
+#define SMP_ADJUDICATE_SCORE 1000
+#define SMP_ADJUDICATE_PLIES 8
+#define SMP_MAX_OPENINGS 1024
+
+static const int smp_thread_counts[] = {1, 8, 32};
+
+typedef struct {
+  search_t search;
+  int thread_count;
+} smp_player_t;
+
+// whether the last position of the game has been on the board twice before
+static uint8_t is_threefold(const thread_t *thread, const position_t *pos) {
+  int seen = 0;
+  const uint32_t end = thread->repetition_index;
+  for (uint32_t offs = 1; offs <= MIN(end, (uint32_t)pos->fifty); offs++) {
+    seen += thread->repetition_table[end + 1 - offs] == pos->hash_keys.hash_key;
+  }
+  return seen >= 2;
+}
+
+static uint8_t is_insufficient_material(const position_t *pos) {
+  return !(pos->bitboards[P] | pos->bitboards[p] | pos->bitboards[R] |
+           pos->bitboards[r] | pos->bitboards[Q] | pos->bitboards[q]) &&
+         popcount(pos->occupancies[both]) <= 3;
+}
+
+// Plays a game from fen, players[color] moving for color. Returns the result
+// for white, 1 for a win, 0 for a draw and -1 for a loss.
+static int play_game(smp_player_t *players[2], position_t *pos,
+                     const char *fen, int nodes) {
+  char command[10000];
+  char go[64];
+  int length = snprintf(command, sizeof(command), "position fen %s moves", fen);
+  snprintf(go, sizeof(go), "go nodes %d", nodes);
+
+  for (int i = 0; i < 2; ++i) {
+    for (int t = 0; t < players[i]->thread_count; ++t) {
+      clear_thread_histories(&players[i]->search.threads[t]);
+    }
+  }
+
+  int adjudicate_plies = 0;
+  for (int ply = 0; ply < SMP_MAX_PLIES; ++ply) {
+    parse_position(pos, players[white]->search.threads, command);
+    smp_player_t *player = players[pos->side];
+    if (player != players[white]) {
+      parse_position(pos, player->search.threads, command);
+    }
+
+    moves move_list[1];
+    generate_noisy(pos, move_list, 0);
+    generate_quiets(pos, move_list, 1);
+    if (!move_list->count) {
+      return !pos->checkers ? 0 : pos->side == white ? -1 : 1;
+    }
+    if (pos->fifty >= 100 || is_insufficient_material(pos) ||
+        is_threefold(player->search.threads, pos)) {
+      return 0;
+    }
+
+    // the players do not share what they found
+    clear_hash_table();
+    time_control(&player->search, pos, go);
+    search_position(&player->search, pos);
+
+    const thread_t *best = player->search.best_thread;
+    const uint16_t move = thread_best_move(best);
+    if (!move) {
+      return 0;
+    }
+
+    // both sides have to agree for a while before the game is called
+    const int16_t score = best->completed_depth ? best->completed_score : 0;
+    const int white_score = pos->side == white ? score : -score;
+    if (abs(white_score) >= SMP_ADJUDICATE_SCORE &&
+        (adjudicate_plies == 0 ||
+         (adjudicate_plies > 0) == (white_score > 0))) {
+      adjudicate_plies += white_score > 0 ? 1 : -1;
+      if (abs(adjudicate_plies) >= SMP_ADJUDICATE_PLIES) {
+        return adjudicate_plies > 0 ? 1 : -1;
+      }
+    } else {
+      adjudicate_plies = 0;
+    }
+
+    char uci_move[6];
+    format_move(uci_move, move);
+    length += snprintf(command + length, sizeof(command) - length, " %s",
+                       uci_move);
+  }
+  return 0;
+}
+
+static int load_openings(const char *path, char openings[][128], int max) {
+  int count = 0;
+  if (!path) {
+    for (; count < MIN(max, BENCH_POSITIONS); ++count) {
+      snprintf(openings[count], 128, "%s", bench_positions[count]);
+    }
+    return count;
+  }
+
+  FILE *in = fopen(path, "r");
+  if (!in) {
+    printf("Could not open %s\n", path);
+    return 0;
+  }
+  char line[256];
+  while (count < max && fgets(line, sizeof(line), in)) {
+    line[strcspn(line, "\r\n")] = '\0';
+    if (*line) {
+      snprintf(openings[count++], 128, "%s", line);
+    }
+  }
+  fclose(in);
+  return count;
+}
+
+static uint8_t init_player(smp_player_t *player, int thread_count) {
+  memset(player, 0, sizeof(smp_player_t));
+  player->search.threads = init_threads(thread_count);
+  player->search.thread_count = thread_count;
+  player->search.silent = 1;
+  player->thread_count = thread_count;
+  return player->search.threads != NULL;
+}
+
+void smp_test(position_t *pos, int nodes, int positions, const char *path) {
+  static char openings[SMP_MAX_OPENINGS][128];
+  positions = load_openings(path, openings, MIN(positions, SMP_MAX_OPENINGS));
+  if (!positions) {
+    return;
+  }
+
+  // the player searches run one after the other and share a single pool
+  static smp_player_t base, tested;
+  if (!init_player(&base, 1)) {
+    return;
+  }
+
+  printf("%d openings, both colors, nodes %d\n", positions, nodes);
+  for (size_t c = 0;
+       c < sizeof(smp_thread_counts) / sizeof(smp_thread_counts[0]); ++c) {
+    if (!init_player(&tested, smp_thread_counts[c])) {
+      break;
+    }
+
+    int wins = 0, draws = 0, losses = 0;
+    const uint64_t start = get_time_ms();
+    for (int game = 0; game < 2 * positions; ++game) {
+      // the tested player takes white in even games
+      const int color = game & 1;
+      smp_player_t *players[2];
+      players[color] = &tested;
+      players[color ^ 1] = &base;
+
+      const int result =
+          play_game(players, pos, openings[game / 2], nodes) *
+          (color == white ? 1 : -1);
+      wins += result > 0;
+      draws += result == 0;
+      losses += result < 0;
+      printf("threads %d game %d/%d +%d =%d -%d\n", tested.thread_count,
+             game + 1, 2 * positions, wins, draws, losses);
+    }
+
+    // Elo from the score, with a 95% interval from its variance
+    const int games = wins + draws + losses;
+    const double score = (wins + 0.5 * draws) / games;
+    const double variance =
+        (wins * pow(1 - score, 2) + draws * pow(0.5 - score, 2) +
+         losses * pow(score, 2)) /
+        games;
+    const double clamped = fmin(fmax(score, 0.001), 0.999);
+    const double elo = -400 * log10(1 / clamped - 1);
+    const double margin = 1.96 * sqrt(variance / games) * 400 /
+                          (log(10) * clamped * (1 - clamped));
+    printf("threads %d vs 1: +%d =%d -%d score %.1f%% elo %+.1f +- %.1f "
+           "(%.0f s)\n",
+           tested.thread_count, wins, draws, losses, 100 * score, elo, margin,
+           (get_time_ms() - start) / 1000.0);
+
+    free_threads(tested.search.threads, tested.thread_count);
+  }
+
+  free_threads(base.search.threads, base.thread_count);
+}
@@ -0,0 +1,8 @@
+#ifndef SMPTEST_H
+#define SMPTEST_H
+
+#include "structs.h"
+
+void smp_test(position_t *pos, int nodes, int positions, const char *path);
+
+#endif
@@ -3,6 +3,7 @@
 
 #include "arch.h"
 #include "bitboards.h"
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stddef.h>
 
@@ -36,11 +37,30 @@ typedef struct tt_entry {
   uint8_t age : 5;  // generation counter; wraps at 32
 } tt_entry_t;
 
+// Bucket size in bytes, picked at build time with TT_BUCKET=32 or 64. A 32
+// byte bucket holds 3 entries, a 64 byte one fills a cache line with 6.
+#ifndef TT_BUCKET_BYTES
+#define TT_BUCKET_BYTES 32
+#endif
+#define TT_BUCKET_ENTRIES ((int)(TT_BUCKET_BYTES / sizeof(tt_entry_t)))
+
 typedef struct tt_bucket {
-  tt_entry_t tt_entries[3];
-  uint16_t padding;
+  _Alignas(TT_BUCKET_BYTES) tt_entry_t tt_entries[TT_BUCKET_ENTRIES];
+  uint8_t padding[TT_BUCKET_BYTES - TT_BUCKET_ENTRIES * sizeof(tt_entry_t)];
 } tt_bucket_t;
 
+_Static_assert(sizeof(tt_bucket_t) == TT_BUCKET_BYTES,
+               "TT_BUCKET_BYTES must be 32 or 64");
+
+// Entries of the per-thread static eval cache, picked at build time with
+// EVAL_CACHE. Every entry packs the upper 48 bits of the hash key with the
+// 16 bit eval, the lower bits of the key select the entry. Off when 0.
+#ifndef EVAL_CACHE_SIZE
+#define EVAL_CACHE_SIZE 0
+#endif
+_Static_assert((EVAL_CACHE_SIZE & (EVAL_CACHE_SIZE - 1)) == 0,
+               "EVAL_CACHE_SIZE must be a power of two");
+
 typedef struct move {
   int score;
   uint16_t move;
@@ -64,6 +84,8 @@ typedef struct simd {
  _Alignas(64) int l2_neurons[L2_SIZE];
  _Alignas(64) float l3_neurons[L3_SIZE];
  _Alignas(64) float l2_floats[2*L2_SIZE];
+ _Alignas(64) uint8_t l2_activations[2*L2_SIZE];
+ _Alignas(64) int32_t l3_ints[L3_SIZE];
 } simd_t;
 
 typedef struct accumulator {
@@ -76,6 +98,14 @@ typedef struct finny_table {
   uint64_t bitboards[2][12];
 } finny_table_t;
 
+// Threat accumulator of one perspective under one king mirror, with the
+// sorted threat features it was built from
+typedef struct threat_finny_table {
+  _Alignas(64) int16_t accumulator[L1_SIZE];
+  int indices[256];
+  int count;
+} threat_finny_table_t;
+
 typedef struct {
   int w_idx[256];
   int b_idx[256];
@@ -126,20 +156,32 @@ typedef struct PV {
   uint16_t pv_table[MAX_PLY + 1][MAX_PLY + 1];
 } PV_t;
 
-typedef struct searchinfo {
-  simd_t neurons;
-  finny_table_t finny_tables[2][KING_BUCKETS];
-  accumulator_t accumulator[MAX_PLY + 10];
-  uint64_t nodes;
-  uint64_t starttime;
-  position_t positions[MAX_PLY + 10];
-  uint8_t ply;
-  uint64_t repetition_table[2000];
-  uint32_t repetition_index;
-  uint32_t nmp_min_ply;
-  PV_t pv;
-  uint16_t index;
+#define MAX_ROOT_MOVES 256
+
+// What one thread spent on and found for a move at the root. Every thread
+// keeps the legal root moves in the same order, so the main thread can add
+// up a move over all threads by its index while the helpers write theirs.
+typedef struct root_move {
+  // only the owning thread writes, the main thread reads while searching
+  atomic_uint_fast64_t nodes;
+  // score and bound of the last time the move was searched, at depth
   int16_t score;
+  uint16_t move;
+  uint8_t bound;
+  uint8_t depth;
+} root_move_t;
+
+// Large per-thread tables. They live in their own mapping so creating or
+// resizing threads does not zero them up front, and so they stay out of the
+// cache lines holding the frequently written thread fields.
+typedef struct thread_tables {
+  accumulator_t accumulator[MAX_PLY + 10];
+  lazy_acc_state_t lazy[MAX_PLY + 10];
+  finny_table_t finny_tables[2][KING_BUCKETS];
+  threat_finny_table_t threat_finny_tables[2][2];
+#if EVAL_CACHE_SIZE
+  uint64_t eval_cache[EVAL_CACHE_SIZE];
+#endif
   int16_t correction_history[2][16384];
   int16_t b_non_pawn_correction_history[2][16384];
   int16_t w_non_pawn_correction_history[2][16384];
@@ -147,12 +189,49 @@ typedef struct searchinfo {
   int16_t continuation_history[13][64][12][64];
   int16_t capture_history[12][13][64][2][2];
   int16_t pawn_history[2048][12][64];
-  lazy_acc_state_t lazy[MAX_PLY + 10];
+} thread_tables_t;
+
+struct search;
+
+typedef struct searchinfo {
+  // updated by the owning thread at every node
+  _Alignas(64) uint64_t nodes;
+  uint64_t tbhits;
+  // threat accumulator refreshes, and how many of them summed every feature
+  uint64_t threat_refreshes;
+  uint64_t threat_rebuilds;
+  // static evals looked up in the eval cache, and how many were found
+  uint64_t eval_cache_probes;
+  uint64_t eval_cache_hits;
+  struct search *search;
+  uint8_t ply;
+  uint8_t quit;
   uint8_t depth;
   uint8_t seldepth;
+  // node and tablebase hit counts published for the other threads of the
+  // search to read, the counts above stay private to the searching thread
+  _Alignas(64) atomic_uint_fast64_t published_nodes;
+  atomic_uint_fast64_t published_tbhits;
+  _Alignas(64) thread_tables_t *tables;
+  uint64_t starttime;
+  uint32_t repetition_index;
+  uint32_t nmp_min_ply;
+  uint16_t index;
+  int16_t score;
+  // score of the last iteration that finished, score itself is garbage once
+  // the search stops inside an iteration
+  int16_t completed_score;
   uint8_t completed_depth;
-  uint8_t stopped;
-  uint8_t quit;
+  // root PV of that iteration, the PV table is reset by the iteration the
+  // stop cuts short
+  uint8_t completed_pv_length;
+  uint16_t completed_pv[MAX_PLY + 1];
+  simd_t neurons;
+  position_t positions[MAX_PLY + 10];
+  uint64_t repetition_table[2000];
+  PV_t pv;
+  root_move_t root_moves[MAX_ROOT_MOVES];
+  uint16_t root_move_count;
 } thread_t;
 
 typedef struct threats {
@@ -180,9 +259,30 @@ typedef struct limits {
   uint8_t nodes_set;
 } limits_t;
 
+// State shared by the threads of one search. The UCI loop runs a single
+// search at a time, the server mode one per concurrent job.
+typedef struct search {
+  // raised once to stop every thread of the search, polled at every node
+  _Alignas(64) atomic_uchar stop;
+  _Alignas(64) limits_t limits;
+  thread_t *threads;
+  int thread_count;
+  // helper i runs on pool worker first_worker + i - 1
+  int first_worker;
+  // searches run from the server mode print nothing themselves
+  uint8_t silent;
+  uint64_t next_time_check;
+  uint64_t last_time_check;
+  uint64_t time_check_interval;
+  moves tb_root_moves;
+  // the thread whose root move and PV the finished search reports
+  thread_t *best_thread;
+} search_t;
+
 typedef struct searchthread {
   position_t *pos;
   thread_t *threads;
+  search_t *search;
   char line[10000];
 } searchthreadinfo_t;
 
@@ -1,11 +1,123 @@
+#include "syzygy.h"
+#include "bitboards.h"
 #include "enums.h"
-#include "structs.h"
+#include "move.h"
+#include "movegen.h"
 #include "pyrrhic/tbprobe.h"
+#include "structs.h"
+#include "uci.h"
+#include <stdio.h>
+
+int syzygy_probe_depth = 1;
+int syzygy_probe_limit = 7;
+
+// Pyrrhic wants a1 = 0 boards, ours are a8 = 0
+static inline uint64_t tb_flip(uint64_t bitboard) {
+  return __builtin_bswap64(bitboard);
+}
+
+void init_syzygy(const char *path) {
+  tb_init(path);
+  if (TB_LARGEST) {
+    printf("info string Syzygy tablebases loaded, %d-man, %d WDL %d DTZ\n",
+           TB_LARGEST, TB_NUM_WDL, TB_NUM_DTZ);
+  } else {
+    printf("info string No Syzygy tablebases loaded\n");
+  }
+}
+
+uint8_t can_probe_wdl(position_t *pos, int depth) {
+  const int cardinality = MIN(TB_LARGEST, syzygy_probe_limit);
+  const int pieces = popcount(pos->occupancies[both]);
+
+  // Probe results are only exact without castling rights and straight after
+  // a zeroing move
+  if (pieces > cardinality || pos->castle || pos->fifty)
+    return 0;
+
+  return pieces < cardinality || depth >= syzygy_probe_depth;
+}
+
+unsigned quant_probe_wdl(position_t *pos) {
+  return tb_probe_wdl(
+      tb_flip(pos->occupancies[white]), tb_flip(pos->occupancies[black]),
+      tb_flip(pos->bitboards[K] | pos->bitboards[k]),
+      tb_flip(pos->bitboards[Q] | pos->bitboards[q]),
+      tb_flip(pos->bitboards[R] | pos->bitboards[r]),
+      tb_flip(pos->bitboards[B] | pos->bitboards[b]),
+      tb_flip(pos->bitboards[N] | pos->bitboards[n]),
+      tb_flip(pos->bitboards[P] | pos->bitboards[p]),
+      pos->enpassant == no_sq ? 0 : pos->enpassant ^ 56, pos->side == white);
+}
+
+// Finds our encoding of a move returned by Pyrrhic
+static uint16_t tb_to_move(position_t *pos, PyrrhicMove tb_move) {
+  const uint8_t source = ((tb_move >> 6) & 63) ^ 56;
+  const uint8_t target = (tb_move & 63) ^ 56;
+  // Pyrrhic promotes: 1 queen, 2 rook, 3 bishop, 4 knight
+  static const uint8_t promotes_to_type[5] = {0, QUEEN, ROOK, BISHOP, KNIGHT};
+  const uint8_t promoted = promotes_to_type[(tb_move >> 12) & 7];
+
+  moves move_list[1];
+  generate_noisy(pos, move_list, 0);
+  generate_quiets(pos, move_list, 1);
+
+  for (uint32_t i = 0; i < move_list->count; ++i) {
+    const uint16_t move = move_list->entry[i].move;
+    if (get_move_source(move) != source || get_move_target(move) != target)
+      continue;
+    if (promoted != (is_move_promotion(move) ? get_move_promoted(white, move)
+                                             : 0))
+      continue;
+    return move;
+  }
+
+  return 0;
+}
+
+// Ranks the root moves with the DTZ tables, falling back to WDL when DTZ
+// files are missing, and keeps only the moves that hold the best outcome.
+// Returns 0 if the root is not covered by the tablebases.
+uint8_t quant_probe_root(position_t *pos, uint8_t has_repeated,
+                         moves *root_moves) {
+  root_moves->count = 0;
+
+  if (popcount(pos->occupancies[both]) > TB_LARGEST || pos->castle)
+    return 0;
+
+  struct TbRootMoves results;
+  const uint64_t white_bb = tb_flip(pos->occupancies[white]);
+  const uint64_t black_bb = tb_flip(pos->occupancies[black]);
+  const uint64_t kings = tb_flip(pos->bitboards[K] | pos->bitboards[k]);
+  const uint64_t queens = tb_flip(pos->bitboards[Q] | pos->bitboards[q]);
+  const uint64_t rooks = tb_flip(pos->bitboards[R] | pos->bitboards[r]);
+  const uint64_t bishops = tb_flip(pos->bitboards[B] | pos->bitboards[b]);
+  const uint64_t knights = tb_flip(pos->bitboards[N] | pos->bitboards[n]);
+  const uint64_t pawns = tb_flip(pos->bitboards[P] | pos->bitboards[p]);
+  const unsigned ep = pos->enpassant == no_sq ? 0 : pos->enpassant ^ 56;
+  const uint8_t turn = pos->side == white;
+
+  int success = tb_probe_root_dtz(white_bb, black_bb, kings, queens, rooks,
+                                  bishops, knights, pawns, pos->fifty, ep,
+                                  turn, has_repeated, 1, &results);
+  if (!success)
+    success = tb_probe_root_wdl(white_bb, black_bb, kings, queens, rooks,
+                                bishops, knights, pawns, pos->fifty, ep, turn,
+                                1, &results);
+  if (!success || results.size == 0)
+    return 0;
+
+  int32_t best_rank = results.moves[0].tbRank;
+  for (unsigned i = 1; i < results.size; ++i)
+    best_rank = MAX(best_rank, results.moves[i].tbRank);
+
+  for (unsigned i = 0; i < results.size; ++i) {
+    if (results.moves[i].tbRank != best_rank)
+      continue;
+    const uint16_t move = tb_to_move(pos, results.moves[i].move);
+    if (move)
+      add_move(root_moves, move);
+  }
 
-/*unsigned quant_probe_wdl(position_t *pos) {
-  unsigned res = tb_probe_wdl(pos->occupancies[0], pos->occupancies[1],
-                      pos->bitboards[k] | pos->bitboards[K], pos->bitboards[q] | pos->bitboards[Q], pos->bitboards[r] | pos->bitboards[R],
-                      pos->bitboards[b] | pos->bitboards[B], pos->bitboards[n] | pos->bitboards[N], pos->bitboards[p] | pos->bitboards[P],
-                      pos->enpassant == no_sq ? 0 : pos->enpassant, pos->side == white ? 1 : 0);
-	return res;
-}*/
+  return root_moves->count > 0;
+}
@@ -1,7 +1,19 @@
 #ifndef SYZYGY_H
 #define SYZYGY_H
 
+#include "bitboards.h"
 #include "structs.h"
-//unsigned quant_probe_wdl(position_t *pos);
+
+// Tablebase wins sit just below the mate band so they are still decisive
+// but never mistaken for a real mate when printed
+#define MATE_IN_MAX_PLY (MATE_VALUE - MAX_PLY)
+#define TB_WIN_SCORE (MATE_IN_MAX_PLY - 1)
+#define TB_WIN_IN_MAX_PLY (TB_WIN_SCORE - MAX_PLY)
+
+void init_syzygy(const char *path);
+uint8_t can_probe_wdl(position_t *pos, int depth);
+unsigned quant_probe_wdl(position_t *pos);
+uint8_t quant_probe_root(position_t *pos, uint8_t has_repeated,
+                         moves *root_moves);
 
 #endif
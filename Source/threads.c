@@ -1,48 +1,339 @@
+#include <inttypes.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "numa.h"
 #include "structs.h"
+#include "threads.h"
+#include "uci.h"
+#include "utils.h"
 
-thread_t *init_threads(int thread_count) {
-    thread_t *threads;
+// Pages the thread tables allocated last got
+static uint8_t tables_pages = SMALL_PAGES;
+
+// Anonymous mappings are zero filled on first touch, so a new thread does not
+// pay for clearing megabytes of tables it may never use. The accumulators,
+// finny tables and histories are on huge pages where the system has them.
+static thread_tables_t *alloc_thread_tables(void) {
+    return (thread_tables_t *)alloc_large(sizeof(thread_tables_t),
+                                          &tables_pages);
+}
+
+static void free_thread_tables(thread_tables_t *tables) {
+    free_large(tables, sizeof(thread_tables_t));
+}
+
+const char *thread_tables_pages(void) { return page_kind(tables_pages); }
 
-#ifdef _WIN32
-    threads = (thread_t *)_aligned_malloc(thread_count * sizeof(thread_t), 64);
+static void *clear_thread(void *thread) {
+    memset(thread, 0, sizeof(thread_t));
+    return NULL;
+}
+
+thread_t *init_threads(int thread_count) {
+    thread_t *threads =
+        (thread_t *)alloc_aligned(64, thread_count * sizeof(thread_t));
     if (!threads) {
         fprintf(stderr, "Thread memory allocation failed.\n");
         return NULL;
     }
-#else
-    size_t size = thread_count * sizeof(thread_t);
-    // Ensure size is a multiple of alignment
-    if (size % 64 != 0) {
-        size += 64 - (size % 64);
+
+    // With NUMA the helper that searches with a thread_t clears it, so its
+    // pages are first touched and allocated on that helper's node
+    const uint8_t numa = numa_enabled && numa_node_count() > 1;
+    for (int thread = 0; thread < thread_count; ++thread) {
+        if (!numa || thread == 0 ||
+            !thread_pool_start(thread - 1, clear_thread, &threads[thread])) {
+            clear_thread(&threads[thread]);
+        }
     }
-    threads = (thread_t *)aligned_alloc(64, size);
-    if (!threads) {
-        fprintf(stderr, "Thread memory allocation failed.\n");
-        return NULL;
+    if (numa) {
+        thread_pool_wait(thread_count - 1);
     }
-#endif
 
     for (int thread = 0; thread < thread_count; ++thread) {
-        memset(&threads[thread], 0, sizeof(threads[thread]));
         threads[thread].index = thread;
+        threads[thread].tables = alloc_thread_tables();
+        if (!threads[thread].tables) {
+            fprintf(stderr, "Thread memory allocation failed.\n");
+            free_threads(threads, thread);
+            return NULL;
+        }
     }
 
     return threads;
 }
 
+void free_threads(thread_t *threads, int thread_count) {
+    if (!threads) {
+        return;
+    }
+
+    for (int thread = 0; thread < thread_count; ++thread) {
+        free_thread_tables(threads[thread].tables);
+    }
+
+    free_aligned(threads);
+}
+
+// Clears a thread and its tables back to the state init_threads left it in
+void reset_thread(thread_t *thread) {
+    thread_tables_t *tables = thread->tables;
+    const uint16_t index = thread->index;
+
+    memset(tables, 0, sizeof(thread_tables_t));
+    memset(thread, 0, sizeof(thread_t));
+    thread->tables = tables;
+    thread->index = index;
+}
+
+// Forgets what a thread learnt about the previous game
+void clear_thread_histories(thread_t *thread) {
+    thread_tables_t *tables = thread->tables;
+    memset(tables->quiet_history, 0, sizeof(tables->quiet_history));
+    memset(tables->capture_history, 0, sizeof(tables->capture_history));
+    memset(tables->continuation_history, 0, sizeof(tables->continuation_history));
+    memset(tables->correction_history, 0, sizeof(tables->correction_history));
+    memset(tables->pawn_history, 0, sizeof(tables->pawn_history));
+    memset(tables->w_non_pawn_correction_history, 0,
+           sizeof(tables->w_non_pawn_correction_history));
+    memset(tables->b_non_pawn_correction_history, 0,
+           sizeof(tables->b_non_pawn_correction_history));
+}
+
+static void *clear_histories_job(void *thread) {
+    clear_thread_histories((thread_t *)thread);
+    return NULL;
+}
+
+// Clears the histories of every thread. With NUMA each helper clears its
+// own, a new game is usually the first thing to touch them.
+void clear_threads_histories(thread_t *threads, int thread_count) {
+    const uint8_t numa = numa_enabled && numa_node_count() > 1;
+    for (int thread = 0; thread < thread_count; ++thread) {
+        if (!numa || thread == 0 ||
+            !thread_pool_start(thread - 1, clear_histories_job,
+                               &threads[thread])) {
+            clear_thread_histories(&threads[thread]);
+        }
+    }
+    if (numa) {
+        thread_pool_wait(thread_count - 1);
+    }
+}
+
+// A worker parks on its condition variable until a job is handed to it, so
+// starting a search or clearing the hash only costs a wakeup per thread
+// instead of a pthread_create/pthread_join pair.
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    void *(*job)(void *);
+    void *arg;
+    int index;
+    uint8_t busy;
+} worker_t;
+
+// Workers are allocated one by one so a growing pool never moves a worker
+// that another thread is still using
+static worker_t **workers = NULL;
+static int worker_count = 0;
+
+static void *worker_loop(void *arg) {
+    worker_t *worker = (worker_t *)arg;
+
+    pthread_mutex_lock(&worker->mutex);
+    while (1) {
+        while (!worker->busy) {
+            pthread_cond_wait(&worker->cond, &worker->mutex);
+        }
+        // a busy worker without a job is the signal to exit
+        if (!worker->job) {
+            break;
+        }
+        pthread_mutex_unlock(&worker->mutex);
+
+        // worker i always runs search thread i + 1. Binding again for every
+        // job picks up a network swapped in since the last one.
+        numa_bind_thread(worker->index + 1);
+        worker->job(worker->arg);
+
+        pthread_mutex_lock(&worker->mutex);
+        worker->busy = 0;
+        pthread_cond_broadcast(&worker->cond);
+    }
+    pthread_mutex_unlock(&worker->mutex);
+
+    return NULL;
+}
+
+static void wait_worker(worker_t *worker) {
+    pthread_mutex_lock(&worker->mutex);
+    while (worker->busy) {
+        pthread_cond_wait(&worker->cond, &worker->mutex);
+    }
+    pthread_mutex_unlock(&worker->mutex);
+}
+
+static void post_worker(worker_t *worker, void *(*job)(void *), void *arg) {
+    pthread_mutex_lock(&worker->mutex);
+    while (worker->busy) {
+        pthread_cond_wait(&worker->cond, &worker->mutex);
+    }
+    worker->job = job;
+    worker->arg = arg;
+    worker->busy = 1;
+    pthread_cond_broadcast(&worker->cond);
+    pthread_mutex_unlock(&worker->mutex);
+}
+
+// Grows or shrinks the pool to count parked workers. Must not be called to
+// shrink the pool while any of the removed workers is running a job.
+void resize_thread_pool(int count) {
+    count = MAX(count, 0);
+
+    while (worker_count > count) {
+        worker_t *worker = workers[--worker_count];
+        post_worker(worker, NULL, NULL);
+        pthread_join(worker->thread, NULL);
+        pthread_mutex_destroy(&worker->mutex);
+        pthread_cond_destroy(&worker->cond);
+        free(worker);
+    }
+
+    if (count > worker_count) {
+        worker_t **grown = (worker_t **)realloc(workers, count * sizeof(worker_t *));
+        if (!grown) {
+            fprintf(stderr, "Thread pool allocation failed.\n");
+            return;
+        }
+        workers = grown;
+
+        while (worker_count < count) {
+            worker_t *worker = (worker_t *)calloc(1, sizeof(worker_t));
+            if (!worker) {
+                fprintf(stderr, "Thread pool allocation failed.\n");
+                return;
+            }
+            pthread_mutex_init(&worker->mutex, NULL);
+            pthread_cond_init(&worker->cond, NULL);
+            worker->index = worker_count;
+            if (pthread_create(&worker->thread, NULL, worker_loop, worker)) {
+                fprintf(stderr, "Thread pool allocation failed.\n");
+                pthread_mutex_destroy(&worker->mutex);
+                pthread_cond_destroy(&worker->cond);
+                free(worker);
+                return;
+            }
+            workers[worker_count++] = worker;
+        }
+    }
+
+    if (!count) {
+        free(workers);
+        workers = NULL;
+    }
+}
+
+// Hands job(arg) to a parked worker, growing the pool if needed. Returns 0,
+// without running the job, when the pool cannot grow to that worker.
+uint8_t thread_pool_start(int worker, void *(*job)(void *), void *arg) {
+    if (worker >= worker_count) {
+        resize_thread_pool(worker + 1);
+        // the pool stays at the size it could reach
+        if (worker >= worker_count) {
+            return 0;
+        }
+    }
+    post_worker(workers[worker], job, arg);
+    return 1;
+}
+
+// Waits until the first count workers have finished their jobs
+void thread_pool_wait(int count) {
+    thread_pool_wait_range(0, count);
+}
+
+// Waits for count workers starting at first, searches running side by side
+// each own a separate range of the pool
+void thread_pool_wait_range(int first, int count) {
+    for (int i = first; i < MIN(first + count, worker_count); ++i) {
+        wait_worker(workers[i]);
+    }
+}
+
+static void *first_node_job(void *arg) {
+    *(uint64_t *)arg = get_time_us();
+    return NULL;
+}
+
+// Measures how long it takes until every helper thread is running, once with
+// freshly created threads and once with the parked pool
+void thread_bench(int thread_count, int iterations) {
+    const int helpers = MAX(thread_count - 1, 1);
+    pthread_t pthreads[helpers];
+    uint64_t started[helpers];
+    uint64_t spawn_total = 0, pool_total = 0;
+
+    resize_thread_pool(helpers);
+    if (worker_count < helpers) {
+        return;
+    }
+
+    for (int i = 0; i < iterations; ++i) {
+        uint64_t start = get_time_us();
+        for (int t = 0; t < helpers; ++t) {
+            pthread_create(&pthreads[t], NULL, first_node_job, &started[t]);
+        }
+        for (int t = 0; t < helpers; ++t) {
+            pthread_join(pthreads[t], NULL);
+        }
+        for (int t = 0; t < helpers; ++t) {
+            spawn_total += started[t] - start;
+        }
+
+        start = get_time_us();
+        for (int t = 0; t < helpers; ++t) {
+            thread_pool_start(t, first_node_job, &started[t]);
+        }
+        thread_pool_wait(helpers);
+        for (int t = 0; t < helpers; ++t) {
+            pool_total += started[t] - start;
+        }
+    }
+
+    const uint64_t samples = (uint64_t)iterations * helpers;
+    printf("threads %d iterations %d\n", thread_count, iterations);
+    printf("pthread_create time to first node: %" PRIu64 " us\n",
+           spawn_total / samples);
+    printf("thread pool time to first node:    %" PRIu64 " us\n",
+           pool_total / samples);
+}
+
 uint64_t total_nodes(thread_t *threads, int thread_count) {
 	uint64_t nodes = 0;
 	for (int thread_index = 0; thread_index < thread_count; ++thread_index) {
-		nodes += threads[thread_index].nodes;
+		nodes += atomic_load_explicit(&threads[thread_index].published_nodes,
+		                              memory_order_relaxed);
 	}
 	return nodes;
 }
 
-void stop_threads(thread_t *threads, int thread_count) {
-	for (int i = 0; i < thread_count; ++i) {
-		threads[i].stopped = 1;
+uint64_t total_tbhits(thread_t *threads, int thread_count) {
+	uint64_t tbhits = 0;
+	for (int thread_index = 0; thread_index < thread_count; ++thread_index) {
+		tbhits += atomic_load_explicit(&threads[thread_index].published_tbhits,
+		                               memory_order_relaxed);
 	}
+	return tbhits;
+}
+
+void stop_threads(search_t *search) {
+	atomic_store_explicit(&search->stop, 1, memory_order_relaxed);
+}
+
+void clear_stop(search_t *search) {
+	atomic_store_explicit(&search->stop, 0, memory_order_relaxed);
 }
@@ -2,9 +2,35 @@
 #define THREADS_H
 
 #include "structs.h"
+#include <stdatomic.h>
+
+#define MAX_THREADS 1024
+
+static inline uint8_t threads_stopped(const thread_t *thread) {
+  return atomic_load_explicit(&thread->search->stop, memory_order_relaxed);
+}
+
+static inline void publish_nodes(thread_t *thread) {
+  atomic_store_explicit(&thread->published_nodes, thread->nodes,
+                        memory_order_relaxed);
+  atomic_store_explicit(&thread->published_tbhits, thread->tbhits,
+                        memory_order_relaxed);
+}
 
 thread_t *init_threads(int thread_count);
+void free_threads(thread_t *threads, int thread_count);
+void reset_thread(thread_t *thread);
+void clear_thread_histories(thread_t *thread);
+void clear_threads_histories(thread_t *threads, int thread_count);
+const char *thread_tables_pages(void);
 uint64_t total_nodes(thread_t *threads, int thread_count);
-void stop_threads(thread_t *threads, int thread_count);
+uint64_t total_tbhits(thread_t *threads, int thread_count);
+void stop_threads(search_t *search);
+void clear_stop(search_t *search);
+void resize_thread_pool(int count);
+uint8_t thread_pool_start(int worker, void *(*job)(void *), void *arg);
+void thread_pool_wait(int count);
+void thread_pool_wait_range(int first, int count);
+void thread_bench(int thread_count, int iterations);
 
 #endif
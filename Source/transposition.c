@@ -1,14 +1,26 @@
 #include "transposition.h"
 #include "bitboards.h"
 #include "enums.h"
+#include "nnue.h"
 #include "structs.h"
+#include "threads.h"
 #include "uci.h"
+#include "utils.h"
+#include <inttypes.h>
 #include <limits.h>
-#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #ifdef __linux__
 #include <sys/mman.h>
 #ifndef MAP_HUGETLB
@@ -30,6 +42,8 @@ __extension__ typedef unsigned __int128 uint128_t;
 
 static size_t tt_alloc_size     = 0;
 static int    tt_used_huge_pages = 0;
+static const char *tt_pages      = "4 KiB pages";
+static int    tt_mapped_file     = 0;
 
 uint8_t tt_age = 0;
 
@@ -39,22 +53,6 @@ void increment_tt_age(void) {
 
 #define AGE_WEIGHT 4
 
-int hash_full(void) {
-  uint64_t used = 0;
-  int samples = 1000;
-
-  for (int i = 0; i < samples; ++i) {
-    for (int j = 0; j < 3; j++) {
-      tt_entry_t *entry = &tt.hash_entry[i].tt_entries[j];
-      if (entry->hash_key != 0 && entry->age == tt_age) {
-        used++;
-      }
-    }
-  }
-
-  return used / ((samples * 3) / 1000);
-}
-
 static inline uint64_t get_hash_index(uint64_t hash) {
   return ((uint128_t)hash * (uint128_t)tt.num_of_entries) >> 64;
 }
@@ -63,6 +61,7 @@ static inline uint16_t get_hash_low_bits(uint64_t hash) {
   return (uint16_t)hash;
 }
 
+// buckets are aligned to their size, so this pulls exactly one cache line
 void prefetch_hash_entry(uint64_t hash_key) {
   const uint64_t index = get_hash_index(hash_key);
   __builtin_prefetch(&tt.hash_entry[index]);
@@ -122,7 +121,6 @@ void *clear_hash_chunk(void *arg) {
 }
 
 void clear_hash_table(void) {
-  pthread_t threads[thread_count];
   thread_data_t thread_data[thread_count];
 
   size_t chunk_size =
@@ -135,26 +133,41 @@ void clear_hash_table(void) {
     thread_data[i].start = start;
     thread_data[i].end = end;
 
-    pthread_create(&threads[i], NULL, clear_hash_chunk, &thread_data[i]);
+    // the calling thread clears the first chunk itself
+    if (i > 0 &&
+        !thread_pool_start(i - 1, clear_hash_chunk, &thread_data[i])) {
+      clear_hash_chunk(&thread_data[i]);
+    }
   }
 
-  for (int i = 0; i < thread_count; i++) {
-    pthread_join(threads[i], NULL);
-  }
+  clear_hash_chunk(&thread_data[0]);
+  thread_pool_wait(thread_count - 1);
 }
 
 void free_hash_table(void) {
   if (tt.hash_entry == NULL) return;
 
+#ifndef _WIN32
+  if (tt_mapped_file) {
+    munmap(tt.hash_entry, tt_alloc_size);
+    tt_mapped_file = 0;
+    tt.hash_entry  = NULL;
+    tt_alloc_size  = 0;
+    return;
+  }
+#endif
+
 #ifdef __linux__
   if (tt_used_huge_pages) {
     munmap(tt.hash_entry, tt_alloc_size);
     tt_used_huge_pages = 0;
   } else {
-    free(tt.hash_entry);
+    free_large(tt.hash_entry, tt_alloc_size);
   }
+#elif defined(_WIN32)
+  _aligned_free(tt.hash_entry);
 #else
-  free(tt.hash_entry);
+  free_large(tt.hash_entry, tt_alloc_size);
 #endif
 
   tt.hash_entry  = NULL;
@@ -185,6 +198,7 @@ void init_hash_table(uint64_t mb) {
     tt.hash_entry      = (tt_bucket_t *)mem;
     tt_alloc_size      = alloc_size;
     tt_used_huge_pages = 1;
+    tt_pages           = "1 GiB huge pages";
     clear_hash_table();
     return;
   }
@@ -199,13 +213,20 @@ void init_hash_table(uint64_t mb) {
     tt.hash_entry      = (tt_bucket_t *)mem;
     tt_alloc_size      = alloc_size;
     tt_used_huge_pages = 1;
+    tt_pages           = "2 MiB huge pages";
     clear_hash_table();
     return;
   }
 #endif
 
-  // allocate memory
-  tt.hash_entry = malloc(alloc_size);
+  // allocate memory, aligned so no bucket straddles two cache lines
+#ifdef _WIN32
+  tt.hash_entry = _aligned_malloc(alloc_size, 64);
+#else
+  // 2 MiB aligned so transparent huge pages can back all of it
+  uint8_t pages;
+  tt.hash_entry = alloc_large(alloc_size, &pages);
+#endif
 
   // if allocation has failed
   if (tt.hash_entry == NULL) {
@@ -218,14 +239,18 @@ void init_hash_table(uint64_t mb) {
   tt_alloc_size      = alloc_size;
   tt_used_huge_pages = 0;
 
-#ifdef __linux__
-  // hint THP to promote pages to huge pages when possible
-  madvise(tt.hash_entry, alloc_size, MADV_HUGEPAGE);
+#ifdef _WIN32
+  tt_pages = "4 KiB pages";
+#else
+  tt_pages = page_kind(pages);
 #endif
 
   clear_hash_table();
 }
 
+// Describes the pages the hash table was allocated on
+const char *hash_pages(void) { return tt_pages; }
+
 uint8_t can_use_score(int alpha, int beta, int tt_score, uint8_t flag) {
   if (tt_score != NO_SCORE &&
       ((flag == HASH_FLAG_EXACT) ||
@@ -245,22 +270,70 @@ int16_t score_from_tt(const uint8_t ply, int16_t score) {
   return score;
 }
 
-// read hash entry data
-tt_entry_t *read_hash_entry(position_t *pos, uint8_t *tt_hit) {
+// Entries are read and written without locks, so a reader can see fields
+// from two different writes. The key is stored XORed with a hash of the rest
+// of the entry, so such torn entries no longer match the position.
+_Static_assert(sizeof(tt_entry_t) == sizeof(uint16_t) + sizeof(uint64_t),
+               "tt_entry_t must be a 16 bit key followed by 64 bits of data");
+
+static inline uint16_t entry_checksum(const tt_entry_t *entry) {
+  uint64_t data;
+  memcpy(&data, (const uint8_t *)entry + sizeof(uint16_t), sizeof(data));
+  return (uint16_t)((data * 0x9E3779B97F4A7C15ULL) >> 48);
+}
+
+static inline uint16_t entry_key(const tt_entry_t *entry) {
+  return entry->hash_key ^ entry_checksum(entry);
+}
+
+// Copies an entry out of the shared table. The barrier stops the compiler
+// from reading the fields again from the table after verification.
+static inline void load_entry(tt_entry_t *dst, const tt_entry_t *src) {
+  memcpy(dst, src, sizeof(tt_entry_t));
+  __asm__ __volatile__("" ::: "memory");
+}
+
+// Counts the entries of this search among the first buckets. An entry is
+// judged by its decoded key, the same one the probe compares, an empty slot
+// decodes to zero.
+int hash_full(void) {
+  uint64_t used = 0;
+  int samples = 1000;
+
+  for (int i = 0; i < samples; ++i) {
+    for (int j = 0; j < TT_BUCKET_ENTRIES; j++) {
+      tt_entry_t entry;
+      load_entry(&entry, &tt.hash_entry[i].tt_entries[j]);
+      if (entry_key(&entry) != 0 && entry.age == tt_age) {
+        used++;
+      }
+    }
+  }
+
+  return used * 1000 / (samples * TT_BUCKET_ENTRIES);
+}
+
+// read hash entry data, a verified copy of the entry is stored in tt_data
+tt_entry_t *read_hash_entry(position_t *pos, uint8_t *tt_hit,
+                            tt_entry_t *tt_data) {
   tt_bucket_t *bucket = &tt.hash_entry[get_hash_index(pos->hash_keys.hash_key)];
+  const uint16_t key16 = get_hash_low_bits(pos->hash_keys.hash_key);
   tt_entry_t *replace = &bucket->tt_entries[0];
   int best_score = INT_MIN;
 
-  for (uint8_t i = 0; i < 3; i++) {
+  for (uint8_t i = 0; i < TT_BUCKET_ENTRIES; i++) {
     tt_entry_t *entry = &bucket->tt_entries[i];
+    tt_entry_t snapshot;
+    load_entry(&snapshot, entry);
 
-    if (entry->hash_key == get_hash_low_bits(pos->hash_keys.hash_key)) {
+    if (entry_key(&snapshot) == key16) {
       *tt_hit = 1;
+      *tt_data = snapshot;
       return entry;
     }
 
-    int age_delta = ((int)tt_age - (int)entry->age) & 0x1F;
-    int score     = age_delta * AGE_WEIGHT - (int)entry->depth;
+    int age_delta = ((int)tt_age - (int)snapshot.age) & 0x1F;
+    int score     = age_delta * AGE_WEIGHT - (int)snapshot.depth;
 
     if (score > best_score) {
       best_score = score;
@@ -276,21 +349,30 @@ tt_entry_t *read_hash_entry(position_t *pos, uint8_t *tt_hit) {
 void write_hash_entry(tt_entry_t *tt_entry, position_t *pos, const uint8_t ply, int16_t score,
                       int16_t static_eval, uint8_t depth, uint16_t move,
                       uint8_t hash_flag, uint8_t tt_pv) {
+  tt_entry_t entry;
+  load_entry(&entry, tt_entry);
+
   uint16_t key16    = get_hash_low_bits(pos->hash_keys.hash_key);
-  uint8_t  same_pos = (tt_entry->hash_key == key16);
-  int      age_delta = ((int)tt_age - (int)tt_entry->age) & 0x1F;
+  uint8_t  same_pos = (entry_key(&entry) == key16);
+  int      age_delta = ((int)tt_age - (int)entry.age) & 0x1F;
+  const uint16_t old_move = entry.move;
 
   // Always preserve the best move we know for this position
   if (move || !same_pos)
-    tt_entry->move = move;
+    entry.move = move;
 
   uint8_t replace =
       !same_pos                                    ||  // different position
       age_delta > 0                                ||  // entry is from a prior search
-      depth + 4 + 2 * tt_pv > tt_entry->depth     ||  // deeper search
+      depth + 4 + 2 * tt_pv > entry.depth          ||  // deeper search
       hash_flag == HASH_FLAG_EXACT;                    // exact bound always wins
 
   if (!replace) {
+    // only the move changed, the key has to be sealed again
+    if (entry.move != old_move) {
+      entry.hash_key = key16 ^ entry_checksum(&entry);
+      memcpy(tt_entry, &entry, sizeof(entry));
+    }
     return;
   }
 
@@ -302,11 +384,236 @@ void write_hash_entry(tt_entry_t *tt_entry, position_t *pos, const uint8_t ply,
     score += ply;
 
   // write hash entry data
-  tt_entry->hash_key    = key16;
-  tt_entry->score       = score;
-  tt_entry->static_eval = static_eval;
-  tt_entry->flag        = hash_flag;
-  tt_entry->tt_pv       = tt_pv;
-  tt_entry->depth       = depth;
-  tt_entry->age         = tt_age;
+  entry.score       = score;
+  entry.static_eval = static_eval;
+  entry.flag        = hash_flag;
+  entry.tt_pv       = tt_pv;
+  entry.depth       = depth;
+  entry.age         = tt_age;
+  entry.hash_key    = key16 ^ entry_checksum(&entry);
+  memcpy(tt_entry, &entry, sizeof(entry));
+}
+
+// Stress test for torn entries: every thread keeps writing and reading a few
+// dozen keys that all map to the first bucket. Each field of an entry is
+// derived from its key, so a copy whose fields disagree came from more than
+// one write.
+#define TT_STRESS_KEYS 48
+
+typedef struct {
+  uint64_t reads;
+  uint64_t hits;
+  uint64_t torn_seen;
+  uint64_t torn_accepted;
+  uint64_t seed;
+} tt_stress_t;
+
+static atomic_uchar tt_stress_stop;
+
+static inline uint8_t stress_entry_torn(const tt_entry_t *entry) {
+  const uint16_t key = entry->move;
+  return entry->score != key + 1000 || entry->static_eval != key + 2000 ||
+         entry->depth != (uint8_t)key;
+}
+
+static void *tt_stress_worker(void *arg) {
+  tt_stress_t *stats = (tt_stress_t *)arg;
+  position_t pos;
+
+  while (!atomic_load_explicit(&tt_stress_stop, memory_order_relaxed)) {
+    stats->seed = stats->seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    const uint16_t key = 1 + (stats->seed >> 33) % TT_STRESS_KEYS;
+    pos.hash_keys.hash_key = key;
+
+    uint8_t tt_hit = 0;
+    tt_entry_t tt_data;
+    tt_entry_t *entry = read_hash_entry(&pos, &tt_hit, &tt_data);
+
+    if ((stats->seed >> 32) & 1) {
+      write_hash_entry(entry, &pos, 0, key + 1000, key + 2000, key, key,
+                       HASH_FLAG_EXACT, 0);
+      continue;
+    }
+
+    stats->reads++;
+    if (tt_hit) {
+      stats->hits++;
+      if (tt_data.move != key || stress_entry_torn(&tt_data))
+        stats->torn_accepted++;
+    }
+
+    tt_bucket_t *bucket = &tt.hash_entry[0];
+    for (int i = 0; i < TT_BUCKET_ENTRIES; ++i) {
+      tt_entry_t snapshot;
+      load_entry(&snapshot, &bucket->tt_entries[i]);
+      if (snapshot.move && stress_entry_torn(&snapshot))
+        stats->torn_seen++;
+    }
+  }
+
+  return NULL;
+}
+
+void tt_stress(int threads, int seconds) {
+  tt_stress_t stats[threads];
+
+  clear_hash_table();
+  atomic_store(&tt_stress_stop, 0);
+  for (int i = 0; i < threads; ++i) {
+    memset(&stats[i], 0, sizeof(stats[i]));
+    stats[i].seed = i + 1;
+    if (!thread_pool_start(i, tt_stress_worker, &stats[i])) {
+      threads = i;
+      break;
+    }
+  }
+
+  const uint64_t end = get_time_ms() + 1000ULL * seconds;
+  while (get_time_ms() < end)
+    sched_yield();
+  atomic_store(&tt_stress_stop, 1);
+  thread_pool_wait(threads);
+
+  tt_stress_t total = {0};
+  for (int i = 0; i < threads; ++i) {
+    total.reads += stats[i].reads;
+    total.hits += stats[i].hits;
+    total.torn_seen += stats[i].torn_seen;
+    total.torn_accepted += stats[i].torn_accepted;
+  }
+
+  printf("threads %d seconds %d\n", threads, seconds);
+  printf("reads %" PRIu64 " hits %" PRIu64 "\n", total.reads, total.hits);
+  printf("torn entries seen in the table: %" PRIu64 "\n", total.torn_seen);
+  printf("torn entries accepted as hits:  %" PRIu64 "\n", total.torn_accepted);
+
+  clear_hash_table();
+}
+
+// Hash files start with this header. The buckets follow at a fixed offset
+// that is a multiple of any page size we run on, so they can be mapped
+// straight from the file.
+#define TT_FILE_MAGIC 0x4853414844435100ULL
+#define TT_FILE_FORMAT 1
+#define TT_FILE_DATA_OFFSET 65536
+
+typedef struct tt_file_header {
+  uint64_t magic;
+  uint32_t format;
+  uint32_t bucket_bytes;
+  uint32_t entry_bytes;
+  uint32_t bucket_entries;
+  uint64_t buckets;
+  uint64_t zobrist_hash;
+  uint64_t net_hash;
+  uint8_t age;
+} tt_file_header_t;
+
+static void fill_file_header(tt_file_header_t *header) {
+  memset(header, 0, sizeof(*header));
+  header->magic = TT_FILE_MAGIC;
+  header->format = TT_FILE_FORMAT;
+  header->bucket_bytes = sizeof(tt_bucket_t);
+  header->entry_bytes = sizeof(tt_entry_t);
+  header->bucket_entries = TT_BUCKET_ENTRIES;
+  header->buckets = tt.num_of_entries;
+  header->zobrist_hash = hash_bytes(&keys, sizeof(keys));
+  header->net_hash = nnue_hash();
+  header->age = tt_age;
+}
+
+// Writes the table to path. Entries being written by a running search may be
+// torn, the checksum in the key rejects those when they are probed again.
+int save_hash_table(const char *path) {
+  FILE *file = fopen(path, "wb");
+  if (!file) {
+    printf("info string Could not open %s for writing\n", path);
+    return 0;
+  }
+
+  static char block[TT_FILE_DATA_OFFSET];
+  memset(block, 0, sizeof(block));
+  tt_file_header_t header;
+  fill_file_header(&header);
+  memcpy(block, &header, sizeof(header));
+
+  const size_t size = tt.num_of_entries * sizeof(tt_bucket_t);
+  const int ok = fwrite(block, 1, sizeof(block), file) == sizeof(block) &&
+                 fwrite(tt.hash_entry, 1, size, file) == size;
+  if (fclose(file) != 0 || !ok) {
+    printf("info string Failed to write hash to %s\n", path);
+    return 0;
+  }
+
+  printf("info string Saved %" PRIu64 " MB of hash to %s\n",
+         (uint64_t)(size >> 20), path);
+  return 1;
+}
+
+// Replaces the table with a private copy on write mapping of a saved one.
+// Only the pages the search touches are read from disk, so even very large
+// tables are usable right away.
+int load_hash_table(const char *path) {
+#ifdef _WIN32
+  printf("info string loadhash is not supported on this platform\n");
+  (void)path;
+  return 0;
+#else
+  const int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    printf("info string Could not open %s\n", path);
+    return 0;
+  }
+
+  tt_file_header_t header, expected;
+  fill_file_header(&expected);
+  struct stat st;
+  const char *error = NULL;
+
+  if (pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+      header.magic != TT_FILE_MAGIC || header.format != TT_FILE_FORMAT)
+    error = "is not a Quanticade hash file";
+  else if (header.bucket_bytes != expected.bucket_bytes ||
+           header.entry_bytes != expected.entry_bytes ||
+           header.bucket_entries != expected.bucket_entries)
+    error = "was saved with a different bucket layout";
+  else if (header.zobrist_hash != expected.zobrist_hash)
+    error = "was saved with different Zobrist keys";
+  else if (header.net_hash != expected.net_hash)
+    error = "was saved with a different network";
+  else if (header.buckets == 0 || fstat(fd, &st) != 0 ||
+           (uint64_t)st.st_size !=
+               TT_FILE_DATA_OFFSET + header.buckets * sizeof(tt_bucket_t))
+    error = "is truncated";
+
+  if (error) {
+    printf("info string Hash file %s %s\n", path, error);
+    close(fd);
+    return 0;
+  }
+
+  const size_t size = header.buckets * sizeof(tt_bucket_t);
+  void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd,
+                   TT_FILE_DATA_OFFSET);
+  close(fd);
+  if (mem == MAP_FAILED) {
+    printf("info string Could not map %s\n", path);
+    return 0;
+  }
+
+  // start reading the file in the background, the probes are random
+  madvise(mem, size, MADV_WILLNEED);
+
+  free_hash_table();
+  tt.hash_entry = (tt_bucket_t *)mem;
+  tt.num_of_entries = header.buckets;
+  tt_alloc_size = size;
+  tt_mapped_file = 1;
+  tt_used_huge_pages = 0;
+  tt_age = header.age;
+
+  printf("info string Loaded %" PRIu64 " MB of hash from %s\n",
+         (uint64_t)(size >> 20), path);
+  return 1;
+#endif
 }
@@ -23,12 +23,16 @@ void free_hash_table(void);
 void prefetch_hash_entry(uint64_t hash_key);
 uint8_t can_use_score(int alpha, int beta, int tt_score, uint8_t flag);
 int16_t score_from_tt(const uint8_t ply, int16_t score);
-tt_entry_t* read_hash_entry(position_t *pos, uint8_t *tt_hit);
+tt_entry_t* read_hash_entry(position_t *pos, uint8_t *tt_hit, tt_entry_t *tt_data);
 void write_hash_entry(tt_entry_t *tt_entry, position_t *pos, const uint8_t ply, int16_t score,
 int16_t static_eval, uint8_t depth, uint16_t move,
 uint8_t hash_flag, uint8_t tt_pv);
 void init_hash_table(uint64_t mb);
+const char *hash_pages(void);
 uint64_t generate_hash_key(position_t *pos);
 int hash_full(void);
+void tt_stress(int threads, int seconds);
+int save_hash_table(const char *path);
+int load_hash_table(const char *path);
 
 #endif
@@ -3,16 +3,21 @@
 #include "bitboards.h"
 #include "datagen.h"
 #include "enums.h"
+#include "evaluate.h"
 #include "history.h"
 #include "move.h"
 #include "movegen.h"
 #include "nnue.h"
+#include "numa.h"
 #include "perft.h"
 #include "pyrrhic/tbprobe.h"
 #include "search.h"
+#include "server.h"
+#include "smptest.h"
 #include "spsa.h"
 #include "stats.h"
 #include "structs.h"
+#include "syzygy.h"
 #include "threads.h"
 #include "transposition.h"
 #include "utils.h"
@@ -43,8 +48,12 @@ int32_t move_overhead = 10;
 uint8_t disable_norm = 0;
 uint8_t soft_nodes = 0;
 uint8_t minimal = 0;
+uint8_t root_move_info = 0;
 uint8_t chess960 = 0;
 
+extern int syzygy_probe_depth;
+extern int syzygy_probe_limit;
+
 TUNABLE(double DEF_TIME_MULTIPLIER = 0.09154524338789537);
 TUNABLE(double DEF_INC_MULTIPLIER = 0.8479206302375195);
 TUNABLE(double MAX_TIME_MULTIPLIER = 0.7519684044383018);
@@ -399,11 +408,12 @@ void parse_position(position_t *pos, thread_t *thread, char *command) {
   }
 }
 
-void time_control(position_t *pos, thread_t *threads, char *line) {
-  threads->stopped = 0;
+void time_control(search_t *search, position_t *pos, char *line) {
+  thread_t *threads = search->threads;
+  limits_t *limits = &search->limits;
   threads->quit = 0;
   threads->starttime = 0;
-  memset(&limits, 0, sizeof(limits_t));
+  memset(limits, 0, sizeof(limits_t));
 
   threads[0].starttime = get_time_ms();
 
@@ -411,64 +421,64 @@ void time_control(position_t *pos, thread_t *threads, char *line) {
 
   if (pos->side == white) {
     if ((argument = strstr(line, "winc")))
-      limits.inc = atoi(argument + 5);
+      limits->inc = atoi(argument + 5);
     if ((argument = strstr(line, "wtime"))) {
-      limits.time = atoi(argument + 6);
-      limits.timeset = 1;
+      limits->time = atoi(argument + 6);
+      limits->timeset = 1;
     }
   } else {
     if ((argument = strstr(line, "binc")))
-      limits.inc = atoi(argument + 5);
+      limits->inc = atoi(argument + 5);
     if ((argument = strstr(line, "btime"))) {
-      limits.time = atoi(argument + 6);
-      limits.timeset = 1;
+      limits->time = atoi(argument + 6);
+      limits->timeset = 1;
     }
   }
 
   if ((argument = strstr(line, "movestogo")))
-    limits.movestogo = atoi(argument + 10);
+    limits->movestogo = atoi(argument + 10);
 
   if ((argument = strstr(line, "movetime"))) {
-    limits.time = atoi(argument + 9);
-    limits.movestogo = 1;
-    limits.timeset = 1;
+    limits->time = atoi(argument + 9);
+    limits->movestogo = 1;
+    limits->timeset = 1;
   }
 
   if ((argument = strstr(line, "nodes"))) {
-    limits.node_limit_soft = atoi(argument + 6);
-    limits.node_limit_hard = soft_nodes ? 10000000 : atoi(argument + 6);
-    limits.depth = MAX_PLY;
-    limits.nodes_set = 1;
+    limits->node_limit_soft = atoi(argument + 6);
+    limits->node_limit_hard = soft_nodes ? 10000000 : atoi(argument + 6);
+    limits->depth = MAX_PLY;
+    limits->nodes_set = 1;
   }
 
   if ((argument = strstr(line, "depth"))) {
-    limits.depth = atoi(argument + 6);
+    limits->depth = atoi(argument + 6);
   } else {
-    limits.depth = limits.depth == 0 ? MAX_PLY : limits.depth;
+    limits->depth = limits->depth == 0 ? MAX_PLY : limits->depth;
 
-    if (limits.timeset) {
+    if (limits->timeset) {
       bool movetime = !!strstr(line, "movetime");
 
       if (movetime) {
-        limits.max_time = MAX(1, limits.time);
-        limits.hard_limit = threads->starttime + limits.max_time;
-        limits.base_soft = 0x7fffffff;
-        limits.soft_limit = threads->starttime + limits.base_soft;
+        limits->max_time = MAX(1, limits->time);
+        limits->hard_limit = threads->starttime + limits->max_time;
+        limits->base_soft = 0x7fffffff;
+        limits->soft_limit = threads->starttime + limits->base_soft;
       } else {
-        limits.time -= MIN(limits.time / 2, move_overhead);
+        limits->time -= MIN(limits->time / 2, move_overhead);
         const int64_t base_time =
-            (limits.movestogo > 0)
-                ? (int64_t)((double)limits.time / limits.movestogo + limits.inc)
-                : (int64_t)(limits.time * DEF_TIME_MULTIPLIER +
-                            limits.inc * DEF_INC_MULTIPLIER);
-
-        limits.max_time =
-            MAX(1, limits.time * (movetime ? 1.0 : MAX_TIME_MULTIPLIER));
-        limits.hard_limit = threads->starttime + limits.max_time;
-        limits.base_soft =
+            (limits->movestogo > 0)
+                ? (int64_t)((double)limits->time / limits->movestogo + limits->inc)
+                : (int64_t)(limits->time * DEF_TIME_MULTIPLIER +
+                            limits->inc * DEF_INC_MULTIPLIER);
+
+        limits->max_time =
+            MAX(1, limits->time * (movetime ? 1.0 : MAX_TIME_MULTIPLIER));
+        limits->hard_limit = threads->starttime + limits->max_time;
+        limits->base_soft =
             movetime ? 0x7fffffff
-                     : MIN(base_time * SOFT_LIMIT_MULTIPLIER, limits.max_time);
-        limits.soft_limit = threads->starttime + limits.base_soft;
+                     : MIN(base_time * SOFT_LIMIT_MULTIPLIER, limits->max_time);
+        limits->soft_limit = threads->starttime + limits->base_soft;
       }
     }
   }
@@ -479,17 +489,18 @@ static inline void *parse_go(void *searchthread_info) {
   char *perft_arg = strstr(sti->line, "perft");
 
   if (perft_arg) {
-    limits.depth = atoi(perft_arg + 6);
-    perft_test(sti->pos, sti->threads, limits.depth);
+    perft_test(sti->pos, atoi(perft_arg + 6), sti->search->thread_count);
     return NULL;
   }
 
-  time_control(sti->pos, sti->threads, sti->line);
-  search_position(sti->pos, sti->threads);
+  increment_tt_age();
+  time_control(sti->search, sti->pos, sti->line);
+  search_position(sti->search, sti->pos);
   return NULL;
 }
 
-void print_move(int move) {
+// Writes the move in UCI notation, out must hold at least 6 characters
+void format_move(char *out, int move) {
   uint8_t source = get_move_source(move);
   uint8_t target = get_move_target(move);
   const uint8_t castling = get_move_castling(move);
@@ -498,11 +509,18 @@ void print_move(int move) {
     target = rank * 8 + (castling == KING_CASTLE ? 6 : 2);
   }
   if (is_move_promotion(move))
-    printf("%s%s%c", square_to_coordinates[source],
-           square_to_coordinates[target],
-           promoted_pieces[get_move_promoted(white, move)]);
+    sprintf(out, "%s%s%c", square_to_coordinates[source],
+            square_to_coordinates[target],
+            promoted_pieces[get_move_promoted(white, move)]);
   else
-    printf("%s%s", square_to_coordinates[source], square_to_coordinates[target]);
+    sprintf(out, "%s%s", square_to_coordinates[source],
+            square_to_coordinates[target]);
+}
+
+void print_move(int move) {
+  char buffer[6];
+  format_move(buffer, move);
+  printf("%s", buffer);
 }
 
 typedef struct {
@@ -517,7 +535,7 @@ typedef struct {
 } uci_ctx_t;
 
 static void stop_search(uci_ctx_t *ctx) {
-  stop_threads(*ctx->threads, *ctx->thread_count);
+  stop_threads(ctx->sti->search);
   if (*ctx->started) {
     pthread_join(*ctx->search_thread, NULL);
     *ctx->started = 0;
@@ -534,32 +552,28 @@ static void handle_position(uci_ctx_t *ctx, char *args) {
   (void)args;
   parse_position(ctx->pos, *ctx->threads, ctx->input);
   init_accumulator(ctx->pos,
-                   &(*ctx->threads)->accumulator[ctx->threads[0]->ply]);
+                   &(*ctx->threads)->tables->accumulator[ctx->threads[0]->ply]);
   init_finny_tables(*ctx->threads, ctx->pos);
 }
 
+static void clear_eval_caches(uci_ctx_t *ctx) {
+  for (int i = 0; i < *ctx->thread_count; ++i) {
+    clear_eval_cache(&(*ctx->threads)[i]);
+  }
+}
+
 static void handle_ucinewgame(uci_ctx_t *ctx, char *args) {
   (void)args;
   clear_hash_table();
-  for (int i = 0; i < *ctx->thread_count; ++i) {
-    thread_t *t = &(*ctx->threads)[i];
-    memset(t->quiet_history, 0, sizeof(t->quiet_history));
-    memset(t->capture_history, 0, sizeof(t->capture_history));
-    memset(t->continuation_history, 0, sizeof(t->continuation_history));
-    memset(t->correction_history, 0, sizeof(t->correction_history));
-    memset(t->pawn_history, 0, sizeof(t->pawn_history));
-    memset(t->w_non_pawn_correction_history, 0,
-           sizeof(t->w_non_pawn_correction_history));
-    memset(t->b_non_pawn_correction_history, 0,
-           sizeof(t->b_non_pawn_correction_history));
-  }
+  clear_threads_histories(*ctx->threads, *ctx->thread_count);
+  clear_eval_caches(ctx);
 }
 
 static void handle_go(uci_ctx_t *ctx, char *args) {
   (void)args;
   if (*ctx->started)
     pthread_join(*ctx->search_thread, NULL);
-  printf("info string NNUE evaluation using %s\n", NETWORK_NAME);
+  printf("info string NNUE evaluation using %s\n", nnue_network_name());
   strncpy(ctx->sti->line, ctx->input, sizeof(ctx->sti->line) - 1);
   ctx->sti->line[sizeof(ctx->sti->line) - 1] = '\0';
   pthread_create(ctx->search_thread, NULL, &parse_go, ctx->sti);
@@ -583,13 +597,19 @@ static void handle_uci(uci_ctx_t *ctx, char *args) {
   printf("option name Hash type spin default %d min 4 max %d\n",
          default_hash_size, ctx->max_hash);
   printf("option name Threads type spin default %d min %d max %d\n", 1, 1,
-         1024);
+         MAX_THREADS);
   printf("option name MoveOverhead type spin default 10 min 0 max 5000\n");
   printf("option name Clear Hash type button\n");
+  printf("option name SyzygyPath type string default <empty>\n");
+  printf("option name SyzygyProbeDepth type spin default 1 min 1 max 100\n");
+  printf("option name SyzygyProbeLimit type spin default 7 min 0 max 7\n");
   printf("option name SoftNodes type check default false\n");
   printf("option name DisableNormalization type check default false\n");
   printf("option name Minimal type check default false\n");
+  printf("option name RootMoveInfo type check default false\n");
   printf("option name UCI_Chess960 type check default false\n");
+  printf("option name NUMA type check default false\n");
+  printf("option name EvalFile type string default <embedded>\n");
 #ifdef TUNE
     print_spsa_table_uci();
 #endif
@@ -609,6 +629,30 @@ static void handle_eval(uci_ctx_t *ctx, char *args) {
   fflush(stdout);
 }
 
+// Returns the file name argument of savehash and loadhash
+static char *hash_file_arg(char *args) {
+  while (*args == ' ')
+    args++;
+  args[strcspn(args, "\r\n")] = '\0';
+  return args;
+}
+
+static void handle_savehash(uci_ctx_t *ctx, char *args) {
+  (void)ctx;
+  char *path = hash_file_arg(args);
+  if (*path)
+    save_hash_table(path);
+}
+
+static void handle_loadhash(uci_ctx_t *ctx, char *args) {
+  char *path = hash_file_arg(args);
+  if (!*path)
+    return;
+  // the search must not probe the table while it is swapped out
+  stop_search(ctx);
+  load_hash_table(path);
+}
+
 typedef struct {
   const char *prefix;
   void (*handler)(uci_ctx_t *, char *);
@@ -625,6 +669,8 @@ static const uci_command_t uci_commands[] = {
     {"uci", handle_uci, 0},
     {"spsa", handle_spsa, 0},
     {"eval", handle_eval, 0},
+    {"savehash", handle_savehash, 0},
+    {"loadhash", handle_loadhash, 0},
 };
 
 static void setoption_hash(uci_ctx_t *ctx, char *value) {
@@ -633,15 +679,27 @@ static void setoption_hash(uci_ctx_t *ctx, char *value) {
   init_hash_table(mb);
 }
 
-static void setoption_threads(uci_ctx_t *ctx, char *value) {
-  *ctx->thread_count = MAX(1, atoi(value));
-#ifndef _WIN32
-  free(*ctx->threads);
-#else
-  _aligned_free(*ctx->threads);
-#endif
-  *ctx->threads = init_threads(*ctx->thread_count);
+static void reinit_threads(uci_ctx_t *ctx, int count) {
+  free_threads(*ctx->threads, *ctx->thread_count);
+  *ctx->threads = init_threads(count);
+  if (!*ctx->threads && count > 1) {
+    // stay usable with the single thread there is room for
+    printf("info string Could not allocate %d threads, using 1\n", count);
+    count = 1;
+    *ctx->threads = init_threads(count);
+  }
+  if (!*ctx->threads) {
+    exit(1);
+  }
+  *ctx->thread_count = count;
   ctx->sti->threads = *ctx->threads;
+  ctx->sti->search->threads = *ctx->threads;
+  ctx->sti->search->thread_count = *ctx->thread_count;
+  resize_thread_pool(*ctx->thread_count - 1);
+}
+
+static void setoption_threads(uci_ctx_t *ctx, char *value) {
+  reinit_threads(ctx, MAX(1, MIN(atoi(value), MAX_THREADS)));
 }
 
 static void setoption_clear_hash(uci_ctx_t *ctx, char *value) {
@@ -652,7 +710,17 @@ static void setoption_clear_hash(uci_ctx_t *ctx, char *value) {
 
 static void setoption_syzygy_path(uci_ctx_t *ctx, char *value) {
   (void)ctx;
-  printf("info string set SyzygyPath to %s\n", value);
+  init_syzygy(value);
+}
+
+static void setoption_syzygy_probe_depth(uci_ctx_t *ctx, char *value) {
+  (void)ctx;
+  syzygy_probe_depth = MAX(1, MIN(atoi(value), 100));
+}
+
+static void setoption_syzygy_probe_limit(uci_ctx_t *ctx, char *value) {
+  (void)ctx;
+  syzygy_probe_limit = MAX(0, MIN(atoi(value), 7));
 }
 
 typedef struct {
@@ -673,8 +741,24 @@ static void setoption_bool(uci_ctx_t *ctx, char *value, uint8_t *target) {
 SETOPTION_BOOL(soft_nodes, soft_nodes)
 SETOPTION_BOOL(disable_norm, disable_norm)
 SETOPTION_BOOL(minimal, minimal)
+SETOPTION_BOOL(root_move_info, root_move_info)
 SETOPTION_BOOL(chess960, chess960)
 
+static void setoption_numa(uci_ctx_t *ctx, char *value) {
+  setoption_bool(ctx, value, &numa_enabled);
+  // restart the workers so they pick up the new binding and reallocate the
+  // thread data so it is first touched on the right nodes
+  resize_thread_pool(0);
+  reinit_threads(ctx, *ctx->thread_count);
+}
+
+static void setoption_eval_file(uci_ctx_t *ctx, char *value) {
+  // the old weights are unmapped, so no search may still be reading them
+  stop_search(ctx);
+  nnue_load_network(value);
+  clear_eval_caches(ctx);
+}
+
 static void setoption_move_overhead(uci_ctx_t *ctx, char *value) {
   (void)ctx;
   move_overhead = atoi(value);
@@ -686,10 +770,15 @@ static const setoption_entry_t setoption_table[] = {
     {"MoveOverhead", setoption_move_overhead},
     {"Clear Hash", setoption_clear_hash},
     {"SyzygyPath", setoption_syzygy_path},
+    {"SyzygyProbeDepth", setoption_syzygy_probe_depth},
+    {"SyzygyProbeLimit", setoption_syzygy_probe_limit},
     {"SoftNodes", setoption_soft_nodes},
     {"DisableNormalization", setoption_disable_norm},
     {"Minimal", setoption_minimal},
+    {"RootMoveInfo", setoption_root_move_info},
     {"UCI_Chess960", setoption_chess960},
+    {"NUMA", setoption_numa},
+    {"EvalFile", setoption_eval_file},
 };
 
 static void handle_setoption(uci_ctx_t *ctx, char *input) {
@@ -733,10 +822,16 @@ void uci_loop(position_t *pos, int argc, char *argv[]) {
   const int max_hash = 524288;
 
   thread_t *threads = init_threads(thread_count);
+  if (!threads) {
+    return;
+  }
 
   pthread_t search_thread;
   uint8_t started = 0;
-  searchthreadinfo_t sti = {.threads = threads, .pos = pos};
+  static search_t search;
+  search.threads = threads;
+  search.thread_count = thread_count;
+  searchthreadinfo_t sti = {.threads = threads, .pos = pos, .search = &search};
 
 #ifndef WIN64
   setbuf(stdin, NULL);
@@ -746,9 +841,13 @@ void uci_loop(position_t *pos, int argc, char *argv[]) {
   char input[10000];
 
   printf("Quanticade %s by DarkNeutrino\n", version);
+  printf("info string NNUE kernels %s\n", nnue_kernel_name());
+  printf("info string NNUE weights on %s\n", nnue_network_pages());
+  printf("info string Thread tables on %s\n", thread_tables_pages());
+  printf("info string Hash on %s\n", hash_pages());
 
   parse_position(pos, threads, "position startpos");
-  init_accumulator(pos, &threads->accumulator[threads[0].ply]);
+  init_accumulator(pos, &threads->tables->accumulator[threads[0].ply]);
   init_finny_tables(threads, pos);
 
   uci_ctx_t ctx = {
@@ -766,20 +865,43 @@ void uci_loop(position_t *pos, int argc, char *argv[]) {
     if (strncmp("bench", argv[1], 5) == 0) {
       minimal = 1;
       uint64_t total_nodes = 0;
+      uint64_t threat_refreshes = 0;
+      uint64_t threat_rebuilds = 0;
+      uint64_t eval_cache_probes = 0;
+      uint64_t eval_cache_hits = 0;
       const uint64_t start_time = get_time_ms();
-      for (int i = 0; i < 50; ++i) {
+      for (int i = 0; i < BENCH_POSITIONS; ++i) {
         memset(input, 0, sizeof(input));
         strcpy(input, "position fen ");
         strcat(input, bench_positions[i]);
-        memset(threads, 0, sizeof(thread_t));
-        printf("\nPosition %d/%d (%s)\n", i, 49, bench_positions[i]);
+        reset_thread(threads);
+        printf("\nPosition %d/%d (%s)\n", i, BENCH_POSITIONS - 1,
+               bench_positions[i]);
         parse_position(pos, threads, input);
-        init_accumulator(pos, &threads->accumulator[threads[0].ply]);
+        init_accumulator(pos, &threads->tables->accumulator[threads[0].ply]);
         init_finny_tables(threads, pos);
-        time_control(pos, threads, "go depth 15");
-        search_position(pos, threads);
+        increment_tt_age();
+        time_control(&search, pos, "go depth 15");
+        search_position(&search, pos);
         total_nodes += threads->nodes;
+        threat_refreshes += threads->threat_refreshes;
+        threat_rebuilds += threads->threat_rebuilds;
+        eval_cache_probes += threads->eval_cache_probes;
+        eval_cache_hits += threads->eval_cache_hits;
       }
+#ifdef BENCH_STATS
+      printf("\n%" PRIu64 " threat refreshes %" PRIu64 " full rebuilds\n",
+             threat_refreshes, threat_rebuilds);
+#else
+      (void)threat_refreshes;
+      (void)threat_rebuilds;
+#endif
+#if EVAL_CACHE_SIZE
+      printf("%" PRIu64 " eval cache probes %" PRIu64 " hits (%.1f%%)\n",
+             eval_cache_probes, eval_cache_hits,
+             eval_cache_probes ? 100.0 * eval_cache_hits / eval_cache_probes
+                               : 0.0);
+#endif
       printf("\n%" PRIu64 " nodes %" PRIu64 " nps\n", total_nodes,
              total_nodes / (get_time_ms() - start_time + 1) * 1000);
       return;
@@ -791,7 +913,91 @@ void uci_loop(position_t *pos, int argc, char *argv[]) {
       int n_of_char_read = 0;
       sscanf(argv[1], "genfens %d seed %99" SCNu64 " book %s %n", &n_of_fens,
              &seed, book, &n_of_char_read);
-      genfens(pos, threads, seed, n_of_fens, book);
+      genfens(pos, &search, seed, n_of_fens, book);
+      return;
+    } else if (strncmp("evalbatch", argv[1], 9) == 0) {
+      char in_file[256];
+      char out_file[256];
+      int eval_threads = cpu_count();
+      if (sscanf(argv[1], "evalbatch %255s %255s %d", in_file, out_file,
+                 &eval_threads) < 2) {
+        printf("usage: evalbatch <in> <out> [threads]\n");
+        return;
+      }
+      eval_batch(in_file, out_file, MAX(1, MIN(eval_threads, MAX_THREADS)));
+      resize_thread_pool(0);
+      return;
+    } else if (strncmp("tailcheck", argv[1], 9) == 0) {
+      char in_file[256];
+      if (sscanf(argv[1], "tailcheck %255s", in_file) != 1) {
+        printf("usage: tailcheck <in>\n");
+        return;
+      }
+      tail_check(in_file);
+      return;
+    } else if (strncmp("nnzsample", argv[1], 9) == 0) {
+      char in_file[256];
+      char out_file[256];
+      if (sscanf(argv[1], "nnzsample %255s %255s", in_file, out_file) != 2) {
+        printf("usage: nnzsample <in> <out>\n");
+        return;
+      }
+      nnz_sample(in_file, out_file);
+      return;
+    } else if (strncmp("nnuebench", argv[1], 9) == 0) {
+      char in_file[256];
+      nnue_bench_suite(sscanf(argv[1], "nnuebench %255s", in_file) == 1
+                           ? in_file
+                           : NULL);
+      return;
+    } else if (strncmp("perftsuite", argv[1], 10) == 0) {
+      char in_file[256];
+      int max_depth = 6;
+      int perft_threads = cpu_count();
+      if (sscanf(argv[1], "perftsuite %255s %d %d", in_file, &max_depth,
+                 &perft_threads) < 1) {
+        printf("usage: perftsuite <epd> [depth] [threads]\n");
+        return;
+      }
+      perft_suite(pos, threads, in_file, max_depth,
+                  MAX(1, MIN(perft_threads, MAX_THREADS)));
+      resize_thread_pool(0);
+      return;
+    } else if (strncmp("smptest", argv[1], 7) == 0) {
+      int nodes = 20000;
+      int positions = BENCH_POSITIONS;
+      char in_file[256];
+      const int fields = sscanf(argv[1], "smptest %d %d %255s", &nodes,
+                                &positions, in_file);
+      smp_test(pos, MAX(nodes, 1), MAX(positions, 1),
+               fields == 3 ? in_file : NULL);
+      resize_thread_pool(0);
+      return;
+    } else if (strncmp("serve", argv[1], 5) == 0) {
+      int jobs = 1;
+      int job_threads = 1;
+      int hash = default_hash_size;
+      sscanf(argv[1], "serve %d %d %d", &jobs, &job_threads, &hash);
+      jobs = MAX(1, MIN(jobs, MAX_THREADS));
+      job_threads = MAX(1, MIN(job_threads, MAX_THREADS / jobs));
+      if (hash != default_hash_size) {
+        init_hash_table(MAX(4, MIN(hash, max_hash)));
+      }
+      serve(jobs, job_threads);
+      return;
+    } else if (strncmp("ttstress", argv[1], 8) == 0) {
+      int stress_threads = 4;
+      int seconds = 5;
+      sscanf(argv[1], "ttstress %d %d", &stress_threads, &seconds);
+      tt_stress(MAX(stress_threads, 1), MAX(seconds, 1));
+      resize_thread_pool(0);
+      return;
+    } else if (strncmp("threadbench", argv[1], 11) == 0) {
+      int bench_threads = 128;
+      int iterations = 100;
+      sscanf(argv[1], "threadbench %d %d", &bench_threads, &iterations);
+      thread_bench(MAX(bench_threads, 2), MAX(iterations, 1));
+      resize_thread_pool(0);
       return;
     }
   }
@@ -834,9 +1040,6 @@ void uci_loop(position_t *pos, int argc, char *argv[]) {
   }
 
 done:
-#ifndef _WIN32
-  free(threads);
-#else
-  _aligned_free(threads);
-#endif
+  resize_thread_pool(0);
+  free_threads(threads, thread_count);
 }
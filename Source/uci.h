@@ -8,15 +8,17 @@
 #define MIN(A, B) ((A) < (B) ? (A) : (B))
 #define MAX(A, B) ((A) > (B) ? (A) : (B))
 
-extern limits_t limits;
-
 extern const char *square_to_coordinates[];
 extern const char promoted_pieces[];
+extern char *bench_positions[];
+
+#define BENCH_POSITIONS 50
 
 void generate_fen(position_t *pos, char *fen);
 void uci_loop(position_t *pos, int argc, char *argv[]);
 void print_move(int move);
+void format_move(char *out, int move);
 void parse_position(position_t *pos, thread_t *thread, char *command);
-void time_control(position_t *pos, thread_t *threads, char *line);
+void time_control(search_t *search, position_t *pos, char *line);
 
 #endif
@@ -2,6 +2,7 @@
 #include "bitboards.h"
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #ifdef WIN64
@@ -10,6 +11,25 @@
 #include <sys/time.h>
 #endif
 
+#ifdef _WIN32
+#include <malloc.h>
+#else
+#include <stdio.h>
+#include <sys/mman.h>
+#endif
+
+#ifdef __linux__
+#ifndef MAP_HUGETLB
+#define MAP_HUGETLB 0x40000
+#endif
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+
+#define LARGE_PAGE_SIZE ((size_t)2 << 20)
+
 // Misc functions. Some of them from VICE by Richard Allbert
 
 int clamp(int d, int min, int max) {
@@ -27,6 +47,47 @@ uint64_t get_time_ms(void) {
 #endif
 }
 
+uint64_t get_time_us(void) {
+#ifdef WIN64
+  LARGE_INTEGER frequency, counter;
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&counter);
+  return (uint64_t)(counter.QuadPart * 1000000 / frequency.QuadPart);
+#else
+  struct timeval time_value;
+  gettimeofday(&time_value, NULL);
+  return (uint64_t)time_value.tv_sec * 1000000 + time_value.tv_usec;
+#endif
+}
+
+// Number of cpus the process can run threads on
+int cpu_count(void) {
+#ifdef WIN64
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return (int)info.dwNumberOfProcessors;
+#else
+  const long count = sysconf(_SC_NPROCESSORS_ONLN);
+  return count > 0 ? (int)count : 1;
+#endif
+}
+
+// 64 bit fingerprint of a block of memory, not meant to be cryptographic
+uint64_t hash_bytes(const void *data, size_t size) {
+  const unsigned char *bytes = data;
+  uint64_t hash = 0xCBF29CE484222325ULL ^ size;
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t word;
+    memcpy(&word, bytes + i, sizeof(word));
+    hash = (hash ^ word) * 0x100000001B3ULL;
+    hash ^= hash >> 29;
+  }
+  for (; i < size; ++i)
+    hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+  return hash ^ (hash >> 32);
+}
+
 uint8_t is_win(int16_t score) {
   return score > MATE_SCORE;
 }
@@ -38,3 +99,123 @@ uint8_t is_loss(int16_t score) {
 uint8_t is_decisive(int16_t score) {
   return abs(score) > MATE_SCORE;
 }
+
+// aligned_alloc only takes sizes that are a multiple of the alignment, so the
+// size is rounded up to one. Blocks must be released with free_aligned.
+void *alloc_aligned(size_t alignment, size_t size) {
+  size = (size + alignment - 1) / alignment * alignment;
+#ifdef _WIN32
+  return _aligned_malloc(size, alignment);
+#else
+  return aligned_alloc(alignment, size);
+#endif
+}
+
+void free_aligned(void *mem) {
+#ifdef _WIN32
+  _aligned_free(mem);
+#else
+  free(mem);
+#endif
+}
+
+// Allocates zeroed memory for a large table that is read at random, where
+// 4 KiB pages would cost a TLB miss on most accesses. Reserved 2 MiB huge
+// pages are tried first, then a 2 MiB aligned mapping the kernel may back
+// with transparent huge pages, and plain pages last. *pages tells which one
+// it got. Blocks must be released with free_large.
+void *alloc_large(size_t size, uint8_t *pages) {
+#ifdef _WIN32
+  void *mem = _aligned_malloc(size, 64);
+  if (mem) {
+    memset(mem, 0, size);
+  }
+  *pages = SMALL_PAGES;
+  return mem;
+#else
+  const size_t rounded = (size + LARGE_PAGE_SIZE - 1) & ~(LARGE_PAGE_SIZE - 1);
+  void *mem;
+
+#ifdef __linux__
+  mem = mmap(NULL, rounded, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_2MB, -1, 0);
+  if (mem != MAP_FAILED) {
+    *pages = HUGE_PAGES;
+    return mem;
+  }
+#endif
+
+  // transparent huge pages only cover aligned 2 MiB ranges, so the mapping
+  // is cut down to one that starts on such a boundary
+  mem = mmap(NULL, rounded + LARGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) {
+    return NULL;
+  }
+  const uintptr_t start = (uintptr_t)mem;
+  const uintptr_t aligned =
+      (start + LARGE_PAGE_SIZE - 1) & ~(uintptr_t)(LARGE_PAGE_SIZE - 1);
+  if (aligned > start) {
+    munmap(mem, aligned - start);
+  }
+  if (start + LARGE_PAGE_SIZE > aligned) {
+    munmap((void *)(aligned + rounded), start + LARGE_PAGE_SIZE - aligned);
+  }
+  mem = (void *)aligned;
+
+#ifdef MADV_HUGEPAGE
+  *pages = madvise(mem, rounded, MADV_HUGEPAGE) == 0 ? TRANSPARENT_HUGE_PAGES
+                                                     : SMALL_PAGES;
+#else
+  *pages = SMALL_PAGES;
+#endif
+  return mem;
+#endif
+}
+
+void free_large(void *mem, size_t size) {
+  if (!mem) {
+    return;
+  }
+#ifdef _WIN32
+  (void)size;
+  _aligned_free(mem);
+#else
+  munmap(mem, (size + LARGE_PAGE_SIZE - 1) & ~(LARGE_PAGE_SIZE - 1));
+#endif
+}
+
+const char *page_kind(uint8_t pages) {
+  return pages == HUGE_PAGES               ? "2 MiB huge pages"
+         : pages == TRANSPARENT_HUGE_PAGES ? "transparent huge pages"
+                                           : "4 KiB pages";
+}
+
+// Bytes of the anonymous mapping starting at mem that the kernel currently
+// backs with transparent huge pages
+uint64_t huge_page_bytes(const void *mem) {
+  uint64_t bytes = 0;
+#ifdef __linux__
+  FILE *smaps = fopen("/proc/self/smaps", "r");
+  if (!smaps) {
+    return 0;
+  }
+  char line[512];
+  uint8_t found = 0;
+  while (fgets(line, sizeof(line), smaps)) {
+    unsigned long long start, end, kb;
+    if (sscanf(line, "%llx-%llx ", &start, &end) == 2) {
+      if (found) {
+        break;
+      }
+      found = start == (uintptr_t)mem;
+    } else if (found && sscanf(line, "AnonHugePages: %llu kB", &kb) == 1) {
+      bytes = kb * 1024;
+    }
+  }
+  fclose(smaps);
+#else
+  (void)mem;
+#endif
+  return bytes;
+}
@@ -1,12 +1,26 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 int clamp(int d, int min, int max);
 uint64_t get_time_ms(void);
+uint64_t get_time_us(void);
+uint64_t hash_bytes(const void *data, size_t size);
+int cpu_count(void);
 uint8_t is_win(int16_t score);
 uint8_t is_loss(int16_t score);
 uint8_t is_decisive(int16_t score);
 
+// Pages backing a block from alloc_large
+enum { SMALL_PAGES, TRANSPARENT_HUGE_PAGES, HUGE_PAGES };
+
+void *alloc_aligned(size_t alignment, size_t size);
+void free_aligned(void *mem);
+void *alloc_large(size_t size, uint8_t *pages);
+void free_large(void *mem, size_t size);
+const char *page_kind(uint8_t pages);
+uint64_t huge_page_bytes(const void *mem);
+
 #endif
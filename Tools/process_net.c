@@ -1,5 +1,6 @@
 #include "../Source/arch.h"
 #include "../Source/nnue.h"
+#include "../Source/utils.h"
 
 #include <math.h>
 #include <stdint.h>
@@ -21,8 +22,117 @@ struct raw_net {
 
 const int INT8_PER_INT32 = sizeof(int) / sizeof(int8_t);
 
+#define PAIRS (L1_SIZE / 2)
+#define MASK_BYTES (L1_SIZE / 8)
+
+static int is_active(const uint8_t *mask, int neuron) {
+  return (mask[neuron / 8] >> (neuron % 8)) & 1;
+}
+
+// Average number of 4 neuron blocks of L1 with an active neuron, neuron i of
+// the reordered network being neuron order[i] of the sampled one
+static double average_nnz(const uint8_t *masks, size_t samples,
+                          const int *order) {
+  uint64_t blocks = 0;
+  for (size_t s = 0; s < samples; s++) {
+    const uint8_t *mask = &masks[s * MASK_BYTES];
+    for (int i = 0; i < L1_SIZE; i += INT8_PER_INT32) {
+      int active = 0;
+      for (int c = 0; c < INT8_PER_INT32; c++) {
+        const int n = i + c;
+        active |= is_active(mask, n < PAIRS ? order[n]
+                                            : order[n - PAIRS] + PAIRS);
+      }
+      blocks += active;
+    }
+  }
+  return samples ? (double)blocks / samples : 0.0;
+}
+
+static int *activity = NULL;
+
+static int by_activity(const void *a, const void *b) {
+  const int x = *(const int *)a;
+  const int y = *(const int *)b;
+  if (activity[x] != activity[y]) {
+    return activity[x] < activity[y] ? -1 : 1;
+  }
+  return x - y;
+}
+
+static void permute_row(float *row, const int *order) {
+  float copy[L1_SIZE];
+  memcpy(copy, row, sizeof(copy));
+  for (int i = 0; i < PAIRS; i++) {
+    row[i] = copy[order[i]];
+    row[i + PAIRS] = copy[order[i] + PAIRS];
+  }
+}
+
+// Reorders the L1 neurons by how often they are active in the sample written
+// by the engine's nnzsample command, so neurons that are mostly zero share
+// the 4 byte blocks L1 skips. Neuron i and i + L1_SIZE / 2 are multiplied
+// together and the same feature transformer serves both perspectives, so a
+// permutation of the pairs is applied to both halves. The network output
+// does not change. The sample has to come from a build of the same network
+// without a sample, it is read in the neuron order of that build.
+static void reorder_neurons(struct raw_net *raw, const char *sample_file) {
+  FILE *in = fopen(sample_file, "rb");
+  if (!in) {
+    printf("Could not open %s, neurons keep their order\n", sample_file);
+    return;
+  }
+  fseek(in, 0, SEEK_END);
+  const size_t samples = ftell(in) / MASK_BYTES;
+  fseek(in, 0, SEEK_SET);
+  uint8_t *masks = malloc(samples * MASK_BYTES + 1);
+  if (!masks || fread(masks, MASK_BYTES, samples, in) != samples) {
+    printf("Could not read %s, neurons keep their order\n", sample_file);
+    free(masks);
+    fclose(in);
+    return;
+  }
+  fclose(in);
+
+  int counts[PAIRS] = {0};
+  for (size_t s = 0; s < samples; s++) {
+    for (int i = 0; i < PAIRS; i++) {
+      counts[i] += is_active(&masks[s * MASK_BYTES], i) +
+                   is_active(&masks[s * MASK_BYTES], i + PAIRS);
+    }
+  }
+
+  int identity[PAIRS];
+  int order[PAIRS];
+  for (int i = 0; i < PAIRS; i++) {
+    identity[i] = order[i] = i;
+  }
+  activity = counts;
+  qsort(order, PAIRS, sizeof(int), by_activity);
+
+  printf("average nnz blocks over %zu positions: %.2f before, %.2f after "
+         "reordering (of %d)\n",
+         samples, average_nnz(masks, samples, identity),
+         average_nnz(masks, samples, order), L1_SIZE / INT8_PER_INT32);
+  free(masks);
+
+  for (int b = 0; b < KING_BUCKETS; b++) {
+    for (int input = 0; input < PSQT_FEATURES; input++) {
+      permute_row(raw->feature_weights[b][input], order);
+    }
+  }
+  for (int t = 0; t < THREAT_FEATURES; t++) {
+    permute_row(raw->feature_threats[t], order);
+  }
+  permute_row(raw->feature_bias, order);
+  for (int b = 0; b < OUTPUT_BUCKETS; b++) {
+    for (int l2 = 0; l2 < L2_SIZE; l2++) {
+      permute_row(raw->l1_weights[b][l2], order);
+    }
+  }
+}
+
 int main(int argc, char *argv[]) {
-  (void)argc;
 
   struct raw_net *raw = malloc(sizeof(struct raw_net));
   nnue_t *processed = malloc(sizeof(nnue_t));
@@ -35,6 +145,10 @@ int main(int argc, char *argv[]) {
   }
   fclose(in);
 
+  if (argc > 3 && *argv[3]) {
+    reorder_neurons(raw, argv[3]);
+  }
+
 #if defined(USE_SIMD)
   for (int b = 0; b < OUTPUT_BUCKETS; b++) {
     for (int l1 = 0; l1 < L1_SIZE / INT8_PER_INT32; l1++) {
@@ -65,6 +179,38 @@ int main(int argc, char *argv[]) {
       }
     }
   }
+#ifdef NNUE_THREAT_INT4
+  // Every block of a threat row gets the smallest shift that keeps its
+  // weights within a nibble, weights that are still out of range are clipped
+  double threat_error = 0;
+  for (int t = 0; t < THREAT_FEATURES; t++) {
+    for (int block = 0; block < L1_SIZE / THREAT_BLOCK; block++) {
+      const float *weights = &raw->feature_threats[t][block * THREAT_BLOCK];
+      int shift = 0;
+      for (int l1 = 0; l1 < THREAT_BLOCK; l1++) {
+        const float w = round(weights[l1] * INPUT_QUANT);
+        while (shift < 7 && (round(w / (1 << shift)) < -8 ||
+                             round(w / (1 << shift)) > 7)) {
+          shift++;
+        }
+      }
+      processed->threat_shifts[t][block] = shift;
+
+      uint8_t *bytes = &processed->feature_threats[t][block * THREAT_BLOCK / 2];
+      memset(bytes, 0, THREAT_BLOCK / 2);
+      for (int l1 = 0; l1 < THREAT_BLOCK; l1++) {
+        const float w = round(weights[l1] * INPUT_QUANT);
+        float q = round(w / (1 << shift));
+        q = q < -8 ? -8 : q > 7 ? 7 : q;
+        threat_error += fabs(w - q * (1 << shift));
+        bytes[l1 % (THREAT_BLOCK / 2)] |= ((int)q & 15)
+                                          << (l1 < THREAT_BLOCK / 2 ? 0 : 4);
+      }
+    }
+  }
+  printf("4 bit threat weights are off by %.3f on average\n",
+         threat_error / THREAT_FEATURES / L1_SIZE);
+#else
   for (int t = 0; t < THREAT_FEATURES; t++) {
     for (int l1 = 0; l1 < L1_SIZE; l1++) {
       float q = round(raw->feature_threats[t][l1] * INPUT_QUANT);
@@ -72,6 +218,7 @@ int main(int argc, char *argv[]) {
       processed->feature_threats[t][l1] = (int8_t)q;
     }
   }
+#endif
   for (int l1 = 0; l1 < L1_SIZE; l1++) {
     processed->feature_bias[l1] = round(raw->feature_bias[l1] * INPUT_QUANT);
   }
@@ -91,8 +238,54 @@ int main(int argc, char *argv[]) {
   memcpy(processed->l2_bias, raw->l2_bias, sizeof(raw->l2_bias));
   memcpy(processed->l3_bias, raw->l3_bias, sizeof(raw->l3_bias));
 
+  // Fixed point layers of the integer tail. An L2 output of 1.0 is l1_scale
+  // in the L1 sums. Its activations come out as x * l1_scale / 2^L2_ACT_SHIFT
+  // and x * x * l2_sqr_scale, the L2 weights undo that so every L3 output of
+  // 1.0 ends up as L3_ONE. L2 weights use the L1 weight layout.
+  const double l1_scale =
+      (double)INPUT_QUANT * INPUT_QUANT * L1_QUANT / (1 << INPUT_SHIFT);
+  const double act_scale = l1_scale / (1 << L2_ACT_SHIFT);
+  const double l2_sqr_scale = l1_scale * l1_scale / (1 << L2_SQR_SHIFT);
+  int clipped = 0;
+  for (int b = 0; b < OUTPUT_BUCKETS; b++) {
+    for (int l2 = 0; l2 < L2_SIZE; l2++) {
+      processed->l1_bias_q[b][l2] = round(raw->l1_bias[b][l2] * l1_scale);
+    }
+    for (int l2 = 0; l2 < 2 * L2_SIZE; l2++) {
+      const double scale =
+          L3_ONE / (l2 < L2_SIZE ? act_scale : l2_sqr_scale);
+      for (int l3 = 0; l3 < L3_SIZE; l3++) {
+        double q = round(raw->l2_weights[b][l3][l2] * scale);
+        if (q < -128 || q > 127) {
+          clipped++;
+          q = q < -128 ? -128 : 127;
+        }
+        processed->l2_weights_q[b][(l2 / INT8_PER_INT32) * INT8_PER_INT32 *
+                                       L3_SIZE +
+                                   l3 * INT8_PER_INT32 + l2 % INT8_PER_INT32] =
+            (int8_t)q;
+      }
+    }
+    for (int l3 = 0; l3 < L3_SIZE; l3++) {
+      processed->l2_bias_q[b][l3] = round(raw->l2_bias[b][l3] * L3_ONE);
+      double q = round(raw->l3_weights[b][l3] * L3_QUANT);
+      if (q < -32768 || q > 32767) {
+        clipped++;
+        q = q < -32768 ? -32768 : 32767;
+      }
+      processed->l3_weights_q[b][l3] = (int16_t)q;
+    }
+  }
+  if (clipped) {
+    printf("%d weights of the integer tail were clipped\n", clipped);
+  }
+
+  const nnue_footer_t footer = {NNUE_FILE_MAGIC, NNUE_FILE_LAYOUT,
+                                hash_bytes(processed, sizeof(nnue_t))};
+
   FILE *out = fopen(argv[2], "wb");
   fwrite(processed, sizeof(nnue_t), 1, out);
+  fwrite(&footer, sizeof(footer), 1, out);
   fclose(out);
 
   free(raw);